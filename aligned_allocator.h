@@ -0,0 +1,85 @@
+// Allocator for over-aligned component storage
+#pragma once
+#include <cstddef>
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <memory_resource>
+#include <utility>
+
+namespace vecs
+{
+    constexpr size_t COMPONENT_ALIGN = 64; // Cache line, also enough for any SIMD load
+
+    /// @brief std allocator that aligns every block to Align bytes, so packed component arrays start on a cache line.
+    /// Takes its memory from resource if one is set (arena, pool, huge pages, ...), from aligned operator new otherwise
+    template <typename T, size_t Align = COMPONENT_ALIGN>
+    struct AlignedAllocator
+    {
+        using value_type = T;
+
+        static constexpr std::align_val_t ALIGNMENT{std::max(Align, alignof(T))};
+
+        template <typename U>
+        struct rebind
+        {
+            using other = AlignedAllocator<U, Align>;
+        };
+
+        std::pmr::memory_resource *resource = nullptr;
+
+        AlignedAllocator() noexcept = default;
+
+        AlignedAllocator(std::pmr::memory_resource *resource) noexcept : resource(resource) {}
+
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Align> &other) noexcept : resource(other.resource) {}
+
+        T *allocate(size_t count)
+        {
+            if (resource != nullptr)
+                return static_cast<T *>(resource->allocate(count * sizeof(T), static_cast<size_t>(ALIGNMENT)));
+
+            return static_cast<T *>(::operator new(count * sizeof(T), ALIGNMENT));
+        }
+
+        void deallocate(T *ptr, size_t count) noexcept
+        {
+            if (resource != nullptr)
+                resource->deallocate(ptr, count * sizeof(T), static_cast<size_t>(ALIGNMENT));
+            else
+                ::operator delete(ptr, ALIGNMENT);
+        }
+
+        template <typename U>
+        inline bool operator==(const AlignedAllocator<U, Align> &other) const noexcept { return resource == other.resource; }
+
+        template <typename U>
+        inline bool operator!=(const AlignedAllocator<U, Align> &other) const noexcept { return resource != other.resource; }
+    };
+
+    /// @brief Per world storage array
+    template <typename T>
+    using StorageVector = std::vector<T, AlignedAllocator<T>>;
+
+    /// @brief Creates a U in memory from resource, or from aligned operator new without one
+    template <typename U, typename... Args>
+    U *createInResource(std::pmr::memory_resource *resource, Args &&...args)
+    {
+        void *memory = resource != nullptr ? resource->allocate(sizeof(U), alignof(U)) : ::operator new(sizeof(U), std::align_val_t(alignof(U)));
+
+        return new (memory) U(std::forward<Args>(args)...);
+    }
+
+    /// @brief Counterpart of createInResource, resource must be the same
+    template <typename U>
+    void destroyInResource(std::pmr::memory_resource *resource, U *object)
+    {
+        object->~U();
+
+        if (resource != nullptr)
+            resource->deallocate(object, sizeof(U), alignof(U));
+        else
+            ::operator delete(object, std::align_val_t(alignof(U)));
+    }
+}
@@ -0,0 +1,268 @@
+// Archetype storage: entities with the same component set share column-major chunks
+#pragma once
+#include <cinttypes>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <vector>
+#include <unordered_map>
+#include "entity.h"
+#include "component_mask.h"
+#include "aligned_allocator.h"
+
+namespace vecs
+{
+    constexpr uint32_t NO_ARCHETYPE = UINT32_MAX;
+    constexpr uint32_t NO_COLUMN = UINT32_MAX;
+
+    constexpr size_t ARCHETYPE_CHUNK_BYTES = 16 * 1024;
+    constexpr size_t ARCHETYPE_COLUMN_ALIGN = 64;
+
+    /// @brief Type erased description of a component, so archetypes can move and destroy rows without knowing T
+    struct ComponentInfo
+    {
+        uint32_t size = 0;
+        uint32_t align = 0;
+
+        void (*relocate)(void *dst, void *src) = nullptr; // Move constructs dst from src, then destroys src
+        void (*destroy)(void *ptr) = nullptr;
+
+        bool trivially_destructible = false;
+    };
+
+    template <typename T>
+    ComponentInfo makeComponentInfo()
+    {
+        ComponentInfo info;
+        info.size = sizeof(T);
+        info.align = alignof(T);
+        info.trivially_destructible = std::is_trivially_destructible_v<T>;
+
+        info.relocate = [](void *dst, void *src)
+        {
+            T *from = static_cast<T *>(src);
+            new (dst) T(std::move(*from));
+            from->~T();
+        };
+
+        info.destroy = [](void *ptr)
+        {
+            static_cast<T *>(ptr)->~T();
+        };
+
+        return info;
+    }
+
+    struct EntityLocation
+    {
+        uint32_t archetype = NO_ARCHETYPE;
+        uint32_t chunk = 0;
+        uint32_t row = 0;
+    };
+
+    /// @brief Fixed size block holding up to capacity rows. Layout: Entity[capacity], then per column one aligned component array
+    /// and one aligned block of added ticks[capacity] followed by changed ticks[capacity]
+    struct ArchetypeChunk
+    {
+        unsigned char *data = nullptr;
+        uint32_t count = 0;
+
+        inline Entity *entities() const
+        {
+            return reinterpret_cast<Entity *>(data);
+        }
+    };
+
+    struct Archetype
+    {
+        /// @param resource Where chunks live, nullptr for operator new
+        Archetype(std::vector<uint32_t> ids, const std::vector<ComponentInfo> &infos, std::pmr::memory_resource *resource = nullptr) : type_ids(std::move(ids)), resource(resource)
+        {
+            size_t row_bytes = sizeof(Entity);
+
+            for (uint32_t type_id : type_ids)
+            {
+                row_bytes += infos[type_id].size + 2 * sizeof(uint32_t);
+                signature.set(type_id);
+
+                if (type_id >= column_of_type.size())
+                    column_of_type.resize(type_id + 1, NO_COLUMN);
+            }
+
+            // Every array starts on its own cache line, reserve the worst case padding for that
+            size_t padding = ARCHETYPE_COLUMN_ALIGN * (2 * type_ids.size() + 1);
+            size_t usable = ARCHETYPE_CHUNK_BYTES > padding ? ARCHETYPE_CHUNK_BYTES - padding : 0;
+
+            chunk_capacity = static_cast<uint32_t>(usable / row_bytes);
+            if (chunk_capacity == 0)
+                chunk_capacity = 1;
+
+            size_t offset = alignUp(sizeof(Entity) * chunk_capacity);
+
+            for (uint32_t i = 0; i < type_ids.size(); i++)
+            {
+                const ComponentInfo &info = infos[type_ids[i]];
+
+                column_of_type[type_ids[i]] = i;
+                column_offsets.push_back(static_cast<uint32_t>(offset));
+                column_infos.push_back(info);
+
+                trivial_rows = trivial_rows && info.trivially_destructible;
+
+                offset = alignUp(offset + size_t(info.size) * chunk_capacity);
+
+                tick_offsets.push_back(static_cast<uint32_t>(offset));
+
+                offset = alignUp(offset + 2 * sizeof(uint32_t) * chunk_capacity);
+            }
+
+            chunk_bytes = offset;
+        }
+
+        ~Archetype()
+        {
+            for (ArchetypeChunk &chunk : chunks)
+            {
+                for (uint32_t row = 0; row < chunk.count && !trivial_rows; row++)
+                    destroyRow(chunk, row);
+
+                freeChunk(chunk);
+            }
+        }
+
+        Archetype(const Archetype &) = delete;
+        Archetype &operator=(const Archetype &) = delete;
+
+        inline uint32_t columnOf(uint32_t type_id) const
+        {
+            return type_id < column_of_type.size() ? column_of_type[type_id] : NO_COLUMN;
+        }
+
+        inline bool hasType(uint32_t type_id) const
+        {
+            return columnOf(type_id) != NO_COLUMN;
+        }
+
+        inline void *column(const ArchetypeChunk &chunk, uint32_t column_index) const
+        {
+            return chunk.data + column_offsets[column_index];
+        }
+
+        inline void *component(const ArchetypeChunk &chunk, uint32_t column_index, uint32_t row) const
+        {
+            return chunk.data + column_offsets[column_index] + size_t(column_infos[column_index].size) * row;
+        }
+
+        inline uint32_t *addedTicks(const ArchetypeChunk &chunk, uint32_t column_index) const
+        {
+            return reinterpret_cast<uint32_t *>(chunk.data + tick_offsets[column_index]);
+        }
+
+        inline uint32_t *changedTicks(const ArchetypeChunk &chunk, uint32_t column_index) const
+        {
+            return addedTicks(chunk, column_index) + chunk_capacity;
+        }
+
+        /// @brief Copies the ticks of one column between rows, possibly of different archetypes
+        inline void copyTicks(const ArchetypeChunk &dst_chunk, uint32_t dst_column, uint32_t dst_row,
+                              const Archetype &src, const ArchetypeChunk &src_chunk, uint32_t src_column, uint32_t src_row) const
+        {
+            addedTicks(dst_chunk, dst_column)[dst_row] = src.addedTicks(src_chunk, src_column)[src_row];
+            changedTicks(dst_chunk, dst_column)[dst_row] = src.changedTicks(src_chunk, src_column)[src_row];
+        }
+
+        /// @brief Reserves a row at the end of the archetype. Component memory and ticks are left uninitialized
+        EntityLocation pushRow(Entity e, uint32_t archetype_index)
+        {
+            if (chunks.empty() || chunks.back().count == chunk_capacity)
+            {
+                ArchetypeChunk chunk;
+                chunk.data = AlignedAllocator<unsigned char, ARCHETYPE_COLUMN_ALIGN>(resource).allocate(chunk_bytes);
+                chunks.push_back(chunk);
+            }
+
+            ArchetypeChunk &chunk = chunks.back();
+            uint32_t row = chunk.count++;
+            chunk.entities()[row] = e;
+
+            entity_count++;
+
+            return {archetype_index, static_cast<uint32_t>(chunks.size() - 1), row};
+        }
+
+        /// @brief Fills the hole at loc with the last row. Components at loc must already be destroyed or moved out
+        /// @return Entity that got moved into loc or NO_ENTITY if loc was the last row
+        Entity popRow(const EntityLocation &loc)
+        {
+            ArchetypeChunk &last_chunk = chunks.back();
+            uint32_t last_row = last_chunk.count - 1;
+            uint32_t last_chunk_index = static_cast<uint32_t>(chunks.size() - 1);
+
+            Entity moved = NO_ENTITY;
+
+            if (loc.chunk != last_chunk_index || loc.row != last_row)
+            {
+                ArchetypeChunk &chunk = chunks[loc.chunk];
+
+                for (uint32_t i = 0; i < column_infos.size(); i++)
+                {
+                    column_infos[i].relocate(component(chunk, i, loc.row), component(last_chunk, i, last_row));
+                    copyTicks(chunk, i, loc.row, *this, last_chunk, i, last_row);
+                }
+
+                moved = last_chunk.entities()[last_row];
+                chunk.entities()[loc.row] = moved;
+            }
+
+            last_chunk.count--;
+            entity_count--;
+
+            if (last_chunk.count == 0)
+            {
+                freeChunk(last_chunk);
+                chunks.pop_back();
+            }
+
+            return moved;
+        }
+
+        void destroyRow(const ArchetypeChunk &chunk, uint32_t row)
+        {
+            for (uint32_t i = 0; i < column_infos.size(); i++)
+                column_infos[i].destroy(component(chunk, i, row));
+        }
+
+        std::vector<uint32_t> type_ids; // Sorted
+        ComponentMask signature;
+        std::vector<uint32_t> column_of_type;
+        std::vector<uint32_t> column_offsets;
+        std::vector<uint32_t> tick_offsets;
+        std::vector<ComponentInfo> column_infos;
+
+        uint32_t chunk_capacity = 0;
+        size_t chunk_bytes = 0;
+
+        std::vector<ArchetypeChunk> chunks;
+        size_t entity_count = 0;
+
+        // Cached transitions, component type id -> archetype index
+        std::unordered_map<uint32_t, uint32_t> add_edges;
+        std::unordered_map<uint32_t, uint32_t> remove_edges;
+
+    private:
+        static inline size_t alignUp(size_t value)
+        {
+            return (value + ARCHETYPE_COLUMN_ALIGN - 1) & ~(ARCHETYPE_COLUMN_ALIGN - 1);
+        }
+
+        inline void freeChunk(ArchetypeChunk &chunk)
+        {
+            AlignedAllocator<unsigned char, ARCHETYPE_COLUMN_ALIGN>(resource).deallocate(chunk.data, chunk_bytes);
+            chunk.data = nullptr;
+        }
+
+        std::pmr::memory_resource *resource = nullptr;
+        bool trivial_rows = true; // No column needs a destructor call, so teardown just frees chunks
+    };
+}
@@ -0,0 +1,84 @@
+// Compares sparse set (plain and grouped) and archetype storage on the Position / Velocity workload from main.cpp
+#include "vox_ecs.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+struct Position
+{
+    float x;
+    float y;
+};
+
+struct Velocity
+{
+    float dx;
+    float dy;
+};
+
+template <typename Func>
+static long long measureMicroseconds(Func &&func)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+static void runBenchmark(const char *name, vecs::StorageMode mode, uint32_t entity_count, uint32_t iterations, bool grouped = false)
+{
+    vecs::Ecs ecs(mode);
+
+    if (grouped)
+        ecs.addGroup<Position, Velocity>();
+
+    long long spawn_time = measureMicroseconds([&]()
+                                               {
+        for (uint32_t i = 0; i < entity_count; i++)
+        {
+            const auto entity = ecs.createEntity();
+
+            ecs.addComponent<Position>(entity, {i * 5.f, i * 1.f});
+
+            if (i % 2 == 0)
+                ecs.addComponent<Velocity>(entity, {5 * 0.1f, i * 0.1f});
+        } });
+
+    long long best = -1;
+    long long total = 0;
+    float checksum = 0.f;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        long long time = measureMicroseconds([&]()
+                                             { ecs.forEach<vecs::Write<Position>, vecs::Read<Velocity>>([](auto view, vecs::Entity e, Position &p, const Velocity &v)
+                                                                                                       {
+                                                                                                           p.x += v.dx;
+                                                                                                           p.y += v.dy; }); });
+
+        best = (best < 0 || time < best) ? time : best;
+        total += time;
+    }
+
+    ecs.forEach<vecs::Read<Position>>([&](auto view, vecs::Entity e, const Position &p)
+                                      { checksum += p.x; });
+
+    std::cout << name << ": spawn " << spawn_time << " us, iterate best " << best << " us, mean "
+              << total / iterations << " us (checksum " << checksum << ")\n";
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t entity_count = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 1'000'000u;
+    uint32_t iterations = argc > 2 ? std::max(1u, static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10))) : 20u;
+
+    std::cout << entity_count << " entities, " << iterations << " iterations\n";
+
+    runBenchmark("SparseSet", vecs::StorageMode::SparseSet, entity_count, iterations);
+    runBenchmark("SparseSet group", vecs::StorageMode::SparseSet, entity_count, iterations, true);
+    runBenchmark("Archetype", vecs::StorageMode::Archetype, entity_count, iterations);
+
+    return 0;
+}
@@ -0,0 +1,554 @@
+// Reproducible benchmark scenarios with warm-up, repetitions and statistics, results are written as JSON
+// Usage: VoxEcsBenchSuite [--filter name] [--max-entities n] [--warmup n] [--repetitions n] [--out file.json]
+#include "vox_ecs.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+template <int I>
+struct Component
+{
+    float value;
+    float scale;
+};
+
+struct Shared
+{
+    float value;
+};
+
+struct Options
+{
+    std::string filter;
+    std::string out_path;
+    uint32_t max_entities = 10'000'000u;
+    size_t warmup = 3;
+    size_t repetitions = 10;
+};
+
+struct Stats
+{
+    double min = 0.0;
+    double max = 0.0;
+    double mean = 0.0;
+    double median = 0.0;
+    double stddev = 0.0;
+};
+
+struct Result
+{
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> params;
+    Stats stats; // Microseconds per repetition
+};
+
+static Stats computeStats(std::vector<double> samples)
+{
+    Stats stats;
+
+    if (samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (double sample : samples)
+        sum += sample;
+
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.mean = sum / samples.size();
+
+    size_t middle = samples.size() / 2;
+    stats.median = samples.size() % 2 == 1 ? samples[middle] : (samples[middle - 1] + samples[middle]) * 0.5;
+
+    double variance = 0.0;
+    for (double sample : samples)
+        variance += (sample - stats.mean) * (sample - stats.mean);
+
+    stats.stddev = samples.size() > 1 ? std::sqrt(variance / (samples.size() - 1)) : 0.0;
+
+    return stats;
+}
+
+/// @brief Runs scenarios and collects their results. setup() runs untimed before every repetition, body() is timed
+class Suite
+{
+public:
+    Suite(Options options) : options(std::move(options)) {}
+
+    inline bool enabled(const std::string &name) const
+    {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    inline uint32_t maxEntities() const
+    {
+        return options.max_entities;
+    }
+
+    template <typename Setup, typename Body>
+    void run(const std::string &name, std::vector<std::pair<std::string, std::string>> params, Setup &&setup, Body &&body)
+    {
+        std::vector<double> samples;
+
+        for (size_t i = 0; i < options.warmup + options.repetitions; i++)
+        {
+            setup();
+
+            auto start = std::chrono::steady_clock::now();
+            body();
+            auto end = std::chrono::steady_clock::now();
+
+            if (i >= options.warmup)
+                samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        }
+
+        Result result{name, std::move(params), computeStats(std::move(samples))};
+
+        std::cerr << result.name;
+        for (const auto &param : result.params)
+            std::cerr << " " << param.first << "=" << param.second;
+        std::cerr << ": median " << result.stats.median << " us, min " << result.stats.min << " us\n";
+
+        results.push_back(std::move(result));
+    }
+
+    void writeJson(std::ostream &out) const
+    {
+        out << "{\n  \"warmup\": " << options.warmup << ",\n  \"repetitions\": " << options.repetitions
+            << ",\n  \"threads\": " << std::thread::hardware_concurrency() << ",\n  \"unit\": \"us\",\n  \"benchmarks\": [\n";
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result &result = results[i];
+
+            out << "    {\"name\": \"" << result.name << "\", \"params\": {";
+
+            for (size_t j = 0; j < result.params.size(); j++)
+                out << (j > 0 ? ", " : "") << "\"" << result.params[j].first << "\": \"" << result.params[j].second << "\"";
+
+            out << "}, \"min\": " << result.stats.min << ", \"median\": " << result.stats.median << ", \"mean\": " << result.stats.mean
+                << ", \"max\": " << result.stats.max << ", \"stddev\": " << result.stats.stddev << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+
+        out << "  ]\n}\n";
+    }
+
+private:
+    Options options;
+    std::vector<Result> results;
+};
+
+static const char *storageName(vecs::StorageMode mode)
+{
+    return mode == vecs::StorageMode::Archetype ? "archetype" : "sparse_set";
+}
+
+static std::vector<uint32_t> entityCounts(const Suite &suite)
+{
+    std::vector<uint32_t> counts;
+
+    for (uint32_t count : {10'000u, 100'000u, 1'000'000u, 10'000'000u})
+        if (count <= suite.maxEntities())
+            counts.push_back(count);
+
+    return counts;
+}
+
+/// @brief Spawns count entities that have Component<Is> for every Is
+template <int... Is>
+static vecs::EntityRange spawnEntities(vecs::Ecs &ecs, uint32_t count)
+{
+    std::tuple<std::vector<Component<Is>>...> columns;
+
+    ((std::get<std::vector<Component<Is>>>(columns).assign(count, Component<Is>{float(Is), 1.0f})), ...);
+
+    return ecs.spawnBatch<Component<Is>...>(vecs::Span<Component<Is>>(std::get<std::vector<Component<Is>>>(columns))...);
+}
+
+// Iteration: one written and up to three read components, every entity matches
+
+template <int... Reads>
+static void iterateCase(Suite &suite, vecs::StorageMode mode, uint32_t count)
+{
+    vecs::Ecs ecs(mode);
+    spawnEntities<0, 1, 2, 3>(ecs, count);
+
+    suite.run("iterate", {{"components", std::to_string(1 + sizeof...(Reads))}, {"entities", std::to_string(count)}, {"storage", storageName(mode)}}, []() {}, [&]()
+              { ecs.forEach<vecs::Write<Component<0>>, vecs::Read<Component<Reads>>...>([](auto &view, vecs::Entity e, Component<0> &target, const Component<Reads> &...sources)
+                                                                                           { target.value = target.value * target.scale + (sources.value + ... + 0.0f); }); });
+}
+
+static void iterationScenarios(Suite &suite)
+{
+    if (!suite.enabled("iterate"))
+        return;
+
+    for (vecs::StorageMode mode : {vecs::StorageMode::SparseSet, vecs::StorageMode::Archetype})
+    {
+        for (uint32_t count : entityCounts(suite))
+        {
+            iterateCase<>(suite, mode, count);
+            iterateCase<1>(suite, mode, count);
+            iterateCase<1, 2>(suite, mode, count);
+            iterateCase<1, 2, 3>(suite, mode, count);
+        }
+    }
+}
+
+// Churn: a quarter of all entities lose and regain a component every repetition
+
+static void churnScenarios(Suite &suite)
+{
+    if (!suite.enabled("churn"))
+        return;
+
+    for (vecs::StorageMode mode : {vecs::StorageMode::SparseSet, vecs::StorageMode::Archetype})
+    {
+        for (uint32_t count : entityCounts(suite))
+        {
+            if (count > 1'000'000u)
+                continue;
+
+            vecs::Ecs ecs(mode);
+            vecs::EntityRange range = spawnEntities<0, 1>(ecs, count);
+
+            suite.run("churn", {{"entities", std::to_string(count)}, {"storage", storageName(mode)}}, []() {}, [&]()
+                      {
+                          for (uint32_t i = 0; i < range.size(); i += 4)
+                              ecs.removeComponent<Component<1>>(range[i]);
+
+                          for (uint32_t i = 0; i < range.size(); i += 4)
+                              ecs.addComponent<Component<1>>(range[i], {1.0f, 1.0f}); });
+        }
+    }
+}
+
+// Teardown: destroying a populated world, its storage either from operator new or from a monotonic arena. The arena
+// gets released untimed in the next setup, that part is the kernel unmapping pages and costs the same for both
+
+static void teardownScenarios(Suite &suite)
+{
+    if (!suite.enabled("teardown"))
+        return;
+
+    for (vecs::StorageMode mode : {vecs::StorageMode::SparseSet, vecs::StorageMode::Archetype})
+    {
+        for (uint32_t count : entityCounts(suite))
+        {
+            if (count > 1'000'000u)
+                continue;
+
+            for (bool arena : {false, true})
+            {
+                std::unique_ptr<std::pmr::monotonic_buffer_resource> resource;
+                std::unique_ptr<vecs::Ecs> ecs;
+
+                suite.run("teardown", {{"entities", std::to_string(count)}, {"storage", storageName(mode)}, {"allocator", arena ? "arena" : "new"}}, [&]()
+                          {
+                              resource = arena ? std::make_unique<std::pmr::monotonic_buffer_resource>() : nullptr;
+                              ecs = std::make_unique<vecs::Ecs>(mode, resource.get());
+
+                              spawnEntities<0, 1, 2>(*ecs, count); }, [&]()
+                          { ecs.reset(); });
+            }
+        }
+    }
+}
+
+// removeEntity storm: every entity of a fresh world gets removed, in random order
+
+static void removeStormScenarios(Suite &suite)
+{
+    if (!suite.enabled("remove_entity_storm"))
+        return;
+
+    for (vecs::StorageMode mode : {vecs::StorageMode::SparseSet, vecs::StorageMode::Archetype})
+    {
+        for (uint32_t count : entityCounts(suite))
+        {
+            if (count > 1'000'000u)
+                continue;
+
+            std::unique_ptr<vecs::Ecs> ecs;
+            std::vector<vecs::Entity> victims;
+            std::mt19937 rng(count);
+
+            suite.run("remove_entity_storm", {{"entities", std::to_string(count)}, {"storage", storageName(mode)}}, [&]()
+                      {
+                          ecs.reset();
+                          ecs = std::make_unique<vecs::Ecs>(mode);
+
+                          vecs::EntityRange range = spawnEntities<0, 1, 2>(*ecs, count);
+
+                          victims.clear();
+                          for (vecs::Entity e : range)
+                              victims.push_back(e);
+
+                          std::shuffle(victims.begin(), victims.end(), rng); }, [&]()
+                      {
+                          for (vecs::Entity e : victims)
+                              ecs->removeEntity(e); });
+        }
+    }
+}
+
+// Scheduling: eight systems with their own component, conflicting ones also write Shared
+
+static constexpr int SYSTEM_COUNT = 8;
+
+template <int I>
+static void addScheduleSystem(vecs::Ecs &ecs, vecs::Schedule &schedule, bool conflicting)
+{
+    auto work = [](Component<I> &component)
+    {
+        for (int k = 0; k < 8; k++)
+            component.value = component.value * component.scale + 0.5f;
+    };
+
+    if (conflicting)
+    {
+        ecs.addSystem<vecs::Write<Component<I>>, vecs::Write<Shared>>(schedule, [work](auto &view, vecs::Entity e, Component<I> &component, Shared &shared)
+                                                                      {
+                                                                          work(component);
+                                                                          shared.value += component.value; });
+    }
+    else
+    {
+        ecs.addSystem<vecs::Write<Component<I>>>(schedule, [work](auto &view, vecs::Entity e, Component<I> &component)
+                                                 { work(component); });
+    }
+}
+
+template <int... Is>
+static void scheduleCase(Suite &suite, uint32_t count, int conflicting, std::integer_sequence<int, Is...>)
+{
+    vecs::Ecs ecs;
+    vecs::EntityRange range = spawnEntities<Is...>(ecs, count);
+
+    std::vector<Shared> shared(count, Shared{0.0f});
+    ecs.insertBatch<Shared>(range, vecs::Span<Shared>(shared));
+
+    vecs::Schedule schedule;
+    (addScheduleSystem<Is>(ecs, schedule, Is < conflicting), ...);
+
+    std::string density = std::to_string(conflicting) + "/" + std::to_string(SYSTEM_COUNT);
+
+    suite.run("run_schedule", {{"entities", std::to_string(count)}, {"conflicting", density}}, []() {}, [&]()
+              { ecs.runSchedule(schedule); });
+
+    suite.run("run_schedule_parallel", {{"entities", std::to_string(count)}, {"conflicting", density}}, []() {}, [&]()
+              { ecs.runScheduleParallel(schedule); });
+}
+
+static void scheduleScenarios(Suite &suite)
+{
+    if (!suite.enabled("run_schedule"))
+        return;
+
+    uint32_t count = std::min(100'000u, suite.maxEntities());
+
+    for (int conflicting : {0, 2, 4, SYSTEM_COUNT})
+        scheduleCase(suite, count, conflicting, std::make_integer_sequence<int, SYSTEM_COUNT>{});
+}
+
+// Multi world: 8 independent worlds on one shared pool, ticked one after another vs all at once with runWorlds
+
+static void multiWorldScenarios(Suite &suite)
+{
+    if (!suite.enabled("multi_world"))
+        return;
+
+    constexpr size_t WORLD_COUNT = 8;
+
+    for (uint32_t count : {10'000u, 100'000u})
+    {
+        if (count > suite.maxEntities())
+            continue;
+
+        thread_pool::ThreadPool pool;
+
+        std::vector<std::unique_ptr<vecs::Ecs>> worlds;
+        std::vector<vecs::Schedule> schedules(WORLD_COUNT);
+        std::vector<vecs::WorldFrame> frames;
+
+        for (size_t i = 0; i < WORLD_COUNT; i++)
+        {
+            worlds.push_back(std::make_unique<vecs::Ecs>(vecs::StorageMode::SparseSet, nullptr, &pool));
+            spawnEntities<0, 1>(*worlds[i], count);
+
+            // Resource ids are process wide, every other world inserts them in the opposite order
+            if (i % 2 == 0)
+            {
+                worlds[i]->insertResource(Component<2>{});
+                worlds[i]->insertResource(Component<3>{});
+            }
+            else
+            {
+                worlds[i]->insertResource(Component<3>{});
+                worlds[i]->insertResource(Component<2>{});
+            }
+
+            worlds[i]->addSystem<vecs::Write<Component<0>>, vecs::Read<Component<1>>>(schedules[i], [](auto &view, vecs::Entity e, Component<0> &a, const Component<1> &b)
+                                                                                        { a.value += b.value * b.scale; });
+            frames.push_back({worlds[i].get(), &schedules[i]});
+        }
+
+        suite.run("multi_world", {{"entities", std::to_string(count)}, {"worlds", std::to_string(WORLD_COUNT)}, {"mode", "sequential"}}, []() {}, [&]()
+                  {
+                      for (size_t i = 0; i < WORLD_COUNT; i++)
+                          worlds[i]->runSchedule(schedules[i]); });
+
+        suite.run("multi_world", {{"entities", std::to_string(count)}, {"worlds", std::to_string(WORLD_COUNT)}, {"mode", "run_worlds"}}, []() {}, [&]()
+                  { vecs::runWorlds(pool, frames); });
+    }
+}
+
+// Query: a selective Without<T> query that matches 1% of the entities, through forEach, a kept Query and a Query with cached matches
+
+static void queryScenarios(Suite &suite)
+{
+    if (!suite.enabled("query"))
+        return;
+
+    for (uint32_t count : entityCounts(suite))
+    {
+        if (count > 1'000'000u)
+            continue;
+
+        vecs::Ecs ecs;
+        vecs::EntityRange range = spawnEntities<0, 1>(ecs, count);
+
+        for (uint32_t i = 0; i < range.size(); i++)
+            if (i % 100 != 0)
+                ecs.addComponent<Component<2>>(range[i], {});
+
+        auto kernel = [](auto &view, vecs::Entity e, Component<0> &target, const Component<1> &source)
+        { target.value = target.value * target.scale + source.value; };
+
+        auto query = ecs.query<vecs::Write<Component<0>>, vecs::Read<Component<1>>, vecs::Without<Component<2>>>();
+        auto cached = ecs.query<vecs::Write<Component<0>>, vecs::Read<Component<1>>, vecs::Without<Component<2>>>(true);
+
+        suite.run("query", {{"entities", std::to_string(count)}, {"mode", "for_each"}}, []() {}, [&]()
+                  { ecs.forEach<vecs::Write<Component<0>>, vecs::Read<Component<1>>, vecs::Without<Component<2>>>(kernel); });
+
+        suite.run("query", {{"entities", std::to_string(count)}, {"mode", "query"}}, []() {}, [&]()
+                  { query.forEach(kernel); });
+
+        suite.run("query", {{"entities", std::to_string(count)}, {"mode", "query_cached"}}, []() {}, [&]()
+                  { cached.forEach(kernel); });
+    }
+}
+
+// Thread pool overhead: empty jobs, and parallelForEach against forEach on small worlds
+
+static void threadPoolScenarios(Suite &suite)
+{
+    if (suite.enabled("pool_jobs"))
+    {
+        thread_pool::ThreadPool pool;
+
+        for (size_t jobs : {1'000u, 100'000u})
+        {
+            std::atomic<size_t> remaining{0};
+
+            suite.run("pool_jobs", {{"jobs", std::to_string(jobs)}}, [&]()
+                      { remaining.store(jobs); }, [&]()
+                      {
+                          for (size_t i = 0; i < jobs; i++)
+                              pool.enqueue([&remaining]()
+                                           { remaining.fetch_sub(1, std::memory_order_release); });
+
+                          pool.waitUntil([&]()
+                                         { return remaining.load(std::memory_order_acquire) == 0; }); });
+        }
+    }
+
+    if (suite.enabled("parallel_dispatch"))
+    {
+        for (uint32_t count : {1'000u, 10'000u, 100'000u})
+        {
+            if (count > suite.maxEntities())
+                continue;
+
+            vecs::Ecs ecs;
+            spawnEntities<0>(ecs, count);
+
+            auto kernel = [](auto &view, vecs::Entity e, Component<0> &component)
+            { component.value = component.value * component.scale + 1.0f; };
+
+            suite.run("parallel_dispatch", {{"entities", std::to_string(count)}, {"mode", "for_each"}}, []() {}, [&]()
+                      { ecs.forEach<vecs::Write<Component<0>>>(kernel); });
+
+            suite.run("parallel_dispatch", {{"entities", std::to_string(count)}, {"mode", "parallel_for_each"}}, []() {}, [&]()
+                      { ecs.parallelForEach<vecs::Write<Component<0>>>(kernel); });
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+
+        if (std::strcmp(argv[i], "--filter") == 0 && has_value)
+            options.filter = argv[++i];
+        else if (std::strcmp(argv[i], "--out") == 0 && has_value)
+            options.out_path = argv[++i];
+        else if (std::strcmp(argv[i], "--max-entities") == 0 && has_value)
+            options.max_entities = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--warmup") == 0 && has_value)
+            options.warmup = std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--repetitions") == 0 && has_value)
+            options.repetitions = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--filter name] [--max-entities n] [--warmup n] [--repetitions n] [--out file.json]\n";
+            return 1;
+        }
+    }
+
+    std::string out_path = options.out_path;
+    Suite suite(std::move(options));
+
+    iterationScenarios(suite);
+    churnScenarios(suite);
+    removeStormScenarios(suite);
+    teardownScenarios(suite);
+    scheduleScenarios(suite);
+    multiWorldScenarios(suite);
+    queryScenarios(suite);
+    threadPoolScenarios(suite);
+
+    if (out_path.empty())
+    {
+        suite.writeJson(std::cout);
+        return 0;
+    }
+
+    std::ofstream out(out_path);
+
+    if (!out)
+    {
+        std::cerr << "Can not write " << out_path << "\n";
+        return 1;
+    }
+
+    suite.writeJson(out);
+
+    return 0;
+}
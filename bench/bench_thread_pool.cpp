@@ -0,0 +1,172 @@
+// Job throughput of the work stealing ThreadPool against the previous single queue pool
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <queue>
+
+// The pool as it was before work stealing: one std::function queue behind one mutex
+class LegacyThreadPool
+{
+public:
+    LegacyThreadPool(size_t thread_count) : stop_flag(false)
+    {
+        for (size_t i = 0; i < thread_count; i++)
+        {
+            workers.emplace_back(&LegacyThreadPool::workerLoop, this);
+        }
+    }
+
+    ~LegacyThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            stop_flag = true;
+        }
+
+        condition.notify_all();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void enqueue(std::function<void()> job)
+    {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            job_queue.push(std::move(job));
+        }
+
+        condition.notify_one();
+    }
+
+    template <typename Pred>
+    void waitUntil(Pred &&done)
+    {
+        while (!done())
+            std::this_thread::yield();
+    }
+
+private:
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                condition.wait(lock, [&]()
+                               { return stop_flag || !job_queue.empty(); });
+
+                if (stop_flag || job_queue.empty())
+                    return;
+
+                job = std::move(job_queue.front());
+                job_queue.pop();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> job_queue;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    std::atomic<bool> stop_flag;
+};
+
+template <typename Func>
+static double measureSeconds(Func &&func)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// Main thread submits every job
+template <typename Pool>
+static double flatThroughput(size_t threads, size_t job_count)
+{
+    Pool pool(threads);
+    std::atomic<size_t> remaining{job_count};
+
+    double seconds = measureSeconds([&]()
+                                    {
+        for (size_t i = 0; i < job_count; i++)
+            pool.enqueue([&remaining]()
+                         { remaining.fetch_sub(1, std::memory_order_relaxed); });
+
+        pool.waitUntil([&]()
+                       { return remaining.load() == 0; }); });
+
+    return job_count / seconds;
+}
+
+// Every job submits children until the tree is job_count jobs big, the parallel iteration pattern
+template <typename Pool>
+static double nestedThroughput(size_t threads, size_t job_count)
+{
+    Pool pool(threads);
+    std::atomic<size_t> remaining{job_count};
+
+    struct Spawner
+    {
+        Pool *pool;
+        std::atomic<size_t> *remaining;
+        size_t first;
+        size_t count;
+
+        void operator()() const
+        {
+            // Split the range in two halves until single jobs are left
+            if (count > 1)
+            {
+                size_t half = count / 2;
+                pool->enqueue(Spawner{pool, remaining, first, half});
+                pool->enqueue(Spawner{pool, remaining, first + half, count - half});
+                return;
+            }
+
+            remaining->fetch_sub(1, std::memory_order_relaxed);
+        }
+    };
+
+    double seconds = measureSeconds([&]()
+                                    {
+        pool.enqueue(Spawner{&pool, &remaining, 0, job_count});
+
+        pool.waitUntil([&]()
+                       { return remaining.load() == 0; }); });
+
+    return job_count / seconds;
+}
+
+int main(int argc, char **argv)
+{
+    size_t job_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000u;
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<size_t> thread_counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    std::cout << job_count << " jobs, million jobs per second\n";
+    std::cout << "threads | flat legacy | flat stealing | nested legacy | nested stealing\n";
+
+    for (size_t threads : thread_counts)
+    {
+        std::cout << threads << " | "
+                  << flatThroughput<LegacyThreadPool>(threads, job_count) / 1e6 << " | "
+                  << flatThroughput<thread_pool::ThreadPool>(threads, job_count) / 1e6 << " | "
+                  << nestedThroughput<LegacyThreadPool>(threads, job_count) / 1e6 << " | "
+                  << nestedThroughput<thread_pool::ThreadPool>(threads, job_count) / 1e6 << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Fixed width set of component type ids
+#pragma once
+#include <cinttypes>
+#include <cstddef>
+
+namespace vecs
+{
+#ifndef VECS_MAX_COMPONENTS
+#define VECS_MAX_COMPONENTS 128
+#endif
+
+    constexpr uint32_t MAX_COMPONENTS = VECS_MAX_COMPONENTS;
+
+    static_assert(MAX_COMPONENTS % 64 == 0, "VECS_MAX_COMPONENTS must be a multiple of 64");
+
+    /// @brief One bit per component type id. Plain words, so masks are trivially copyable and compare with a few (vectorizable) ops
+    struct ComponentMask
+    {
+        static constexpr size_t WORDS = MAX_COMPONENTS / 64;
+
+        uint64_t words[WORDS] = {};
+
+        inline void set(uint32_t type_id)
+        {
+            words[type_id / 64] |= uint64_t(1) << (type_id % 64);
+        }
+
+        inline void reset(uint32_t type_id)
+        {
+            words[type_id / 64] &= ~(uint64_t(1) << (type_id % 64));
+        }
+
+        inline bool test(uint32_t type_id) const
+        {
+            return (words[type_id / 64] >> (type_id % 64)) & 1;
+        }
+
+        /// @brief True if every bit of other is set here
+        inline bool containsAll(const ComponentMask &other) const
+        {
+            uint64_t missing = 0;
+
+            for (size_t i = 0; i < WORDS; i++)
+                missing |= other.words[i] & ~words[i];
+
+            return missing == 0;
+        }
+
+        /// @brief Sets every bit of other
+        inline void merge(const ComponentMask &other)
+        {
+            for (size_t i = 0; i < WORDS; i++)
+                words[i] |= other.words[i];
+        }
+
+        inline bool intersects(const ComponentMask &other) const
+        {
+            uint64_t common = 0;
+
+            for (size_t i = 0; i < WORDS; i++)
+                common |= other.words[i] & words[i];
+
+            return common != 0;
+        }
+
+        inline bool none() const
+        {
+            uint64_t any = 0;
+
+            for (size_t i = 0; i < WORDS; i++)
+                any |= words[i];
+
+            return any == 0;
+        }
+
+        inline void clear()
+        {
+            for (size_t i = 0; i < WORDS; i++)
+                words[i] = 0;
+        }
+
+        /// @brief Calls func(type_id) for every set bit in ascending order
+        template <typename Func>
+        inline void forEachSetBit(Func &&func) const
+        {
+            for (size_t i = 0; i < WORDS; i++)
+            {
+                uint64_t word = words[i];
+
+                while (word != 0)
+                {
+                    uint32_t bit = countTrailingZeros(word);
+                    func(static_cast<uint32_t>(i * 64 + bit));
+
+                    word &= word - 1;
+                }
+            }
+        }
+
+        inline bool operator==(const ComponentMask &other) const
+        {
+            uint64_t diff = 0;
+
+            for (size_t i = 0; i < WORDS; i++)
+                diff |= other.words[i] ^ words[i];
+
+            return diff == 0;
+        }
+
+    private:
+        static inline uint32_t countTrailingZeros(uint64_t word)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<uint32_t>(__builtin_ctzll(word));
+#else
+            uint32_t count = 0;
+            while ((word & 1) == 0)
+            {
+                word >>= 1;
+                count++;
+            }
+            return count;
+#endif
+        }
+    };
+}
@@ -0,0 +1,141 @@
+// Set of entity indices that changed since it was last cleared, feeds delta snapshots
+#pragma once
+#include <cinttypes>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+namespace vecs
+{
+    /// @brief Two level bitmap over entity indices: one bit per index, one summary bit per word of 64 indices.
+    /// mark is thread safe, walking and clearing only look at summary words and the marked words below them,
+    /// so both cost O(marked + capacity / 4096). Marking is off until setTracking(true)
+    class DirtySet
+    {
+    public:
+        inline bool isTracking() const
+        {
+            return tracking;
+        }
+
+        /// @brief Turning tracking off also forgets every mark
+        void setTracking(bool enabled)
+        {
+            if (!enabled)
+                clear();
+
+            tracking = enabled;
+        }
+
+        /// @brief Makes room for indices below count. Structural, must not run concurrently with mark
+        void reserve(uint32_t count)
+        {
+            size_t needed_words = (static_cast<size_t>(count) + 63) / 64;
+
+            if (needed_words <= word_count)
+                return;
+
+            size_t new_word_count = std::max<size_t>(std::max<size_t>(needed_words, word_count * 2), 64);
+            size_t new_summary_count = (new_word_count + 63) / 64;
+
+            std::unique_ptr<std::atomic<uint64_t>[]> new_words(new std::atomic<uint64_t>[new_word_count]());
+            std::unique_ptr<std::atomic<uint64_t>[]> new_summary(new std::atomic<uint64_t>[new_summary_count]());
+
+            for (size_t i = 0; i < word_count; i++)
+                new_words[i].store(words[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+            for (size_t i = 0; i < summaryCount(); i++)
+                new_summary[i].store(summary[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+            words = std::move(new_words);
+            summary = std::move(new_summary);
+            word_count = new_word_count;
+        }
+
+        /// @brief index must be below the reserved count
+        inline void mark(uint32_t index)
+        {
+            std::atomic<uint64_t> &word = words[index >> 6];
+            uint64_t bit = uint64_t(1) << (index & 63);
+
+            // Repeated writes to the same entity only cost the load
+            if ((word.load(std::memory_order_relaxed) & bit) != 0)
+                return;
+
+            if (word.fetch_or(bit, std::memory_order_relaxed) == 0)
+                summary[index >> 12].fetch_or(uint64_t(1) << ((index >> 6) & 63), std::memory_order_relaxed);
+        }
+
+        inline bool test(uint32_t index) const
+        {
+            return (index >> 6) < word_count && (words[index >> 6].load(std::memory_order_relaxed) & (uint64_t(1) << (index & 63))) != 0;
+        }
+
+        /// @brief Calls func(index) for every marked index in ascending order, must not run concurrently with mark
+        template <typename Func>
+        void forEach(Func &&func) const
+        {
+            forEachWord([&](size_t word_index, uint64_t bits)
+                        {
+                            while (bits != 0)
+                            {
+                                func(static_cast<uint32_t>(word_index * 64 + countTrailingZeros(bits)));
+                                bits &= bits - 1;
+                            } });
+        }
+
+        void clear()
+        {
+            forEachWord([&](size_t word_index, uint64_t)
+                        { words[word_index].store(0, std::memory_order_relaxed); });
+
+            for (size_t i = 0; i < summaryCount(); i++)
+                summary[i].store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        template <typename Func>
+        void forEachWord(Func &&func) const
+        {
+            for (size_t i = 0; i < summaryCount(); i++)
+            {
+                uint64_t marked_words = summary[i].load(std::memory_order_relaxed);
+
+                while (marked_words != 0)
+                {
+                    size_t word_index = i * 64 + countTrailingZeros(marked_words);
+                    func(word_index, words[word_index].load(std::memory_order_relaxed));
+
+                    marked_words &= marked_words - 1;
+                }
+            }
+        }
+
+        inline size_t summaryCount() const
+        {
+            return (word_count + 63) / 64;
+        }
+
+        static inline uint32_t countTrailingZeros(uint64_t word)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<uint32_t>(__builtin_ctzll(word));
+#else
+            uint32_t count = 0;
+            while ((word & 1) == 0)
+            {
+                word >>= 1;
+                count++;
+            }
+            return count;
+#endif
+        }
+
+        bool tracking = false;
+
+        std::unique_ptr<std::atomic<uint64_t>[]> words;   // Bit per entity index
+        std::unique_ptr<std::atomic<uint64_t>[]> summary; // Bit per word that has a mark
+        size_t word_count = 0;
+    };
+}
@@ -0,0 +1,341 @@
+// Entity handles and the per world id allocator
+#pragma once
+#include <cinttypes>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include "dirty_set.h"
+
+namespace vecs
+{
+    // Entity = [generation | index]. The index addresses all per entity storage, the generation detects stale handles
+    using Entity = uint32_t;
+
+#ifndef VECS_ENTITY_INDEX_BITS
+#define VECS_ENTITY_INDEX_BITS 24
+#endif
+
+    constexpr uint32_t ENTITY_INDEX_BITS = VECS_ENTITY_INDEX_BITS;
+    constexpr uint32_t ENTITY_INDEX_MASK = (uint32_t(1) << ENTITY_INDEX_BITS) - 1;
+    constexpr uint32_t ENTITY_GENERATION_MASK = UINT32_MAX >> ENTITY_INDEX_BITS; // Generations wrap, with 24 index bits after 256 reuses of an index
+
+    constexpr Entity NO_ENTITY = UINT32_MAX;
+
+    static_assert(ENTITY_INDEX_BITS > 0 && ENTITY_INDEX_BITS < 32, "Entities need index and generation bits");
+
+    inline constexpr uint32_t entityIndex(Entity e)
+    {
+        return e & ENTITY_INDEX_MASK;
+    }
+
+    inline constexpr uint32_t entityGeneration(Entity e)
+    {
+        return e >> ENTITY_INDEX_BITS;
+    }
+
+    inline constexpr Entity makeEntity(uint32_t index, uint32_t generation)
+    {
+        return (generation << ENTITY_INDEX_BITS) | index;
+    }
+
+    /// @brief Contiguous block of fresh entities, all with generation 0
+    struct EntityRange
+    {
+        struct Iterator
+        {
+            Entity e;
+
+            inline Entity operator*() const { return e; }
+            inline Iterator &operator++()
+            {
+                ++e;
+                return *this;
+            }
+            inline bool operator!=(const Iterator &other) const { return e != other.e; }
+        };
+
+        Entity first = 0;
+        uint32_t count = 0;
+
+        inline Iterator begin() const { return {first}; }
+        inline Iterator end() const { return {first + count}; }
+        inline uint32_t size() const { return count; }
+        inline Entity operator[](uint32_t i) const { return first + i; }
+    };
+
+    /// @brief Hands out entity ids per world. Destroyed indices go to a free list and come back with the next generation.
+    /// create / createRange / destroy are structural and single threaded, reserve can be called from any thread
+    /// and its entities become regular ones on flushReserved. Generations wrap after ENTITY_GENERATION_MASK + 1 reuses
+    /// of an index, a handle kept that long can alias a newer entity.
+    class EntityAllocator
+    {
+    public:
+        /// @brief Set in the generation table for indices on the free list, never part of a generation since those
+        /// have at most 31 bits. Free indices are therefore never alive, whatever generation a handle claims
+        static constexpr uint32_t FREE_SLOT = uint32_t(1) << 31;
+
+        static_assert(ENTITY_GENERATION_MASK < FREE_SLOT, "Generations must leave the top bit free");
+
+        Entity create()
+        {
+            flushReserved();
+
+            if (!free_list.empty())
+            {
+                uint32_t index = free_list.back();
+                free_list.pop_back();
+                free_cursor.store(static_cast<int64_t>(free_list.size()), std::memory_order_relaxed);
+
+                free_list_low = std::min(free_list_low, free_list.size());
+                generations[index] &= ~FREE_SLOT;
+                touch(index);
+
+                return makeEntity(index, generations[index]);
+            }
+
+            uint32_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+            assert(index < ENTITY_INDEX_MASK && "Out of entity indices");
+
+            generations.push_back(0);
+            touch(index);
+
+            return makeEntity(index, 0);
+        }
+
+        /// @brief count fresh entities with consecutive ids, the free list is not used
+        EntityRange createRange(uint32_t count)
+        {
+            flushReserved();
+
+            uint32_t first = next_index.fetch_add(count, std::memory_order_relaxed);
+            assert(uint64_t(first) + count <= ENTITY_INDEX_MASK && "Out of entity indices");
+
+            generations.resize(first + count, 0);
+
+            for (uint32_t i = 0; i < count && touched.isTracking(); i++)
+                touch(first + i);
+
+            return {makeEntity(first, 0), count};
+        }
+
+        /// @brief Thread safe, takes a recycled index first, otherwise a fresh one
+        Entity reserve()
+        {
+            int64_t cursor = free_cursor.fetch_sub(1, std::memory_order_relaxed);
+
+            if (cursor > 0)
+            {
+                uint32_t index = free_list[cursor - 1];
+                return makeEntity(index, generations[index] & ~FREE_SLOT);
+            }
+
+            uint32_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+            assert(index < ENTITY_INDEX_MASK && "Out of entity indices");
+
+            return makeEntity(index, 0);
+        }
+
+        /// @brief Thread safe, reserves count entities into out with one atomic operation on the free list and at most one
+        /// on the fresh indices, so per thread blocks of ids cost two shared writes instead of one per entity
+        void reserveBlock(Entity *out, uint32_t count)
+        {
+            int64_t cursor = free_cursor.fetch_sub(count, std::memory_order_relaxed);
+
+            // This thread owns free list entries [cursor - count, cursor), those below 0 do not exist
+            uint32_t recycled = static_cast<uint32_t>(std::clamp<int64_t>(cursor, 0, count));
+
+            for (uint32_t i = 0; i < recycled; i++)
+            {
+                uint32_t index = free_list[cursor - 1 - i];
+                out[i] = makeEntity(index, generations[index] & ~FREE_SLOT);
+            }
+
+            if (recycled == count)
+                return;
+
+            uint32_t first = next_index.fetch_add(count - recycled, std::memory_order_relaxed);
+            assert(uint64_t(first) + (count - recycled) <= ENTITY_INDEX_MASK && "Out of entity indices");
+
+            for (uint32_t i = recycled; i < count; i++)
+                out[i] = makeEntity(first + (i - recycled), 0);
+        }
+
+        /// @brief Puts reserved entities that never got used back on the free list. Their generation stays as it is,
+        /// since no handle to them got out. Call after flushReserved, not concurrently with reserve
+        void returnReserved(const Entity *reserved, uint32_t count)
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                uint32_t index = entityIndex(reserved[i]);
+
+                generations[index] |= FREE_SLOT;
+                free_list.push_back(index);
+                touch(index);
+            }
+
+            free_cursor.store(static_cast<int64_t>(free_list.size()), std::memory_order_relaxed);
+        }
+
+        /// @brief Turns reserved entities into regular ones, must not run concurrently with reserve
+        void flushReserved()
+        {
+            int64_t cursor = free_cursor.load(std::memory_order_relaxed);
+
+            if (cursor < static_cast<int64_t>(free_list.size()))
+            {
+                size_t kept = cursor > 0 ? static_cast<size_t>(cursor) : 0;
+
+                for (size_t i = kept; i < free_list.size(); i++)
+                {
+                    generations[free_list[i]] &= ~FREE_SLOT;
+                    touch(free_list[i]);
+                }
+
+                free_list.resize(kept);
+                free_cursor.store(static_cast<int64_t>(free_list.size()), std::memory_order_relaxed);
+
+                free_list_low = std::min(free_list_low, free_list.size());
+            }
+
+            uint32_t index_count = next_index.load(std::memory_order_relaxed);
+
+            for (uint32_t i = static_cast<uint32_t>(generations.size()); i < index_count && touched.isTracking(); i++)
+                touch(i);
+
+            if (generations.size() < index_count)
+                generations.resize(index_count, 0);
+        }
+
+        /// @return false if e was already destroyed
+        bool destroy(Entity e)
+        {
+            flushReserved();
+
+            if (!isAlive(e))
+                return false;
+
+            uint32_t index = entityIndex(e);
+            generations[index] = ((generations[index] + 1) & ENTITY_GENERATION_MASK) | FREE_SLOT;
+
+            free_list.push_back(index);
+            free_cursor.store(static_cast<int64_t>(free_list.size()), std::memory_order_relaxed);
+
+            touch(index);
+
+            return true;
+        }
+
+        inline bool isAlive(Entity e) const
+        {
+            uint32_t index = entityIndex(e);
+            return index < generations.size() && generations[index] == entityGeneration(e);
+        }
+
+        /// @brief Number of indices ever handed out, upper bound for all per entity arrays
+        inline uint32_t indexCount() const
+        {
+            return next_index.load(std::memory_order_relaxed);
+        }
+
+        /// @brief Current generation per index, indices on the free list have FREE_SLOT set on top of the generation
+        /// they come back with
+        inline const std::vector<uint32_t> &generationTable() const
+        {
+            return generations;
+        }
+
+        inline const std::vector<uint32_t> &freeList() const
+        {
+            return free_list;
+        }
+
+        /// @brief Replaces the whole state, e.g. when loading a snapshot. No entity may be reserved at that point
+        void restore(std::vector<uint32_t> generation_table, std::vector<uint32_t> free_indices)
+        {
+            generations = std::move(generation_table);
+            free_list = std::move(free_indices);
+
+            // Tables from before free slots got flagged
+            for (uint32_t index : free_list)
+                if (index < generations.size())
+                    generations[index] |= FREE_SLOT;
+
+            free_cursor.store(static_cast<int64_t>(free_list.size()), std::memory_order_relaxed);
+            next_index.store(static_cast<uint32_t>(generations.size()), std::memory_order_relaxed);
+
+            free_list_low = free_list.size();
+        }
+
+        /// @brief Starts or stops recording which indices got created or destroyed, see touchedIndices
+        void setTracking(bool enabled)
+        {
+            touched.setTracking(enabled);
+            touched.reserve(indexCount());
+
+            free_list_low = free_list.size();
+        }
+
+        /// @brief Indices whose generation or liveness changed since tracking started or the last clearTouched
+        inline const DirtySet &touchedIndices() const
+        {
+            return touched;
+        }
+
+        /// @brief Free list entries below this stayed untouched since tracking started or the last clearTouched
+        inline size_t unchangedFreeListPrefix() const
+        {
+            return std::min(free_list_low, free_list.size());
+        }
+
+        void clearTouched()
+        {
+            touched.clear();
+            free_list_low = free_list.size();
+        }
+
+        /// @brief Overwrites the generation of one index, growing the index range if needed. Used to replay deltas,
+        /// no entity may be reserved at that point
+        void setGeneration(uint32_t index, uint32_t generation)
+        {
+            if (index >= generations.size())
+            {
+                generations.resize(index + 1, 0);
+                next_index.store(index + 1, std::memory_order_relaxed);
+            }
+
+            generations[index] = generation;
+            touch(index);
+        }
+
+        /// @brief Keeps the first keep free list entries and appends count indices, the counterpart of unchangedFreeListPrefix
+        void replaceFreeListTail(size_t keep, const uint32_t *indices, size_t count)
+        {
+            free_list.resize(std::min(keep, free_list.size()));
+            free_list.insert(free_list.end(), indices, indices + count);
+
+            free_cursor.store(static_cast<int64_t>(free_list.size()), std::memory_order_relaxed);
+            free_list_low = std::min(free_list_low, keep);
+        }
+
+    private:
+        inline void touch(uint32_t index)
+        {
+            if (touched.isTracking())
+            {
+                touched.reserve(index + 1);
+                touched.mark(index);
+            }
+        }
+
+        std::vector<uint32_t> generations; // Current generation per index
+        std::vector<uint32_t> free_list;
+
+        std::atomic<int64_t> free_cursor{0}; // Free list entries below the cursor are still available for reserve
+        std::atomic<uint32_t> next_index{0};
+
+        DirtySet touched;
+        size_t free_list_low = 0; // Lowest free list size since the last clearTouched
+    };
+}
@@ -0,0 +1,99 @@
+// memory_resource backed by 2 MiB pages, meant as the upstream of an arena or pool that holds a world's storage
+#pragma once
+#include <cinttypes>
+#include <cstddef>
+#include <new>
+#include <memory_resource>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+namespace vecs
+{
+    /// @brief Every allocation is rounded up to whole huge pages and mapped on its own, so put a
+    /// std::pmr::monotonic_buffer_resource or pool resource in front of it. Tries explicit huge pages (MAP_HUGETLB) first,
+    /// then transparent huge pages (MADV_HUGEPAGE), then plain pages. Not thread safe on its own, like the std::pmr arenas
+    class HugePageResource : public std::pmr::memory_resource
+    {
+    public:
+        static constexpr size_t HUGE_PAGE_BYTES = size_t(2) << 20;
+
+        /// @brief Bytes currently mapped
+        inline size_t mappedBytes() const
+        {
+            return mapped_bytes;
+        }
+
+        /// @brief Bytes ever mapped with explicit huge pages, whether transparent ones get used is up to the kernel
+        inline size_t hugeTlbBytes() const
+        {
+            return huge_tlb_bytes;
+        }
+
+    private:
+        static inline size_t roundUp(size_t bytes)
+        {
+            return (bytes + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+        }
+
+        void *do_allocate(size_t bytes, size_t alignment) override
+        {
+            size_t size = roundUp(bytes > 0 ? bytes : 1);
+
+            if (alignment > HUGE_PAGE_BYTES)
+                throw std::bad_alloc();
+
+#if defined(__unix__) || defined(__APPLE__)
+            void *memory = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+            memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+            if (memory != MAP_FAILED)
+                huge_tlb_bytes += size;
+#endif
+
+            if (memory == MAP_FAILED)
+            {
+                memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+                if (memory == MAP_FAILED)
+                    throw std::bad_alloc();
+
+#ifdef MADV_HUGEPAGE
+                ::madvise(memory, size, MADV_HUGEPAGE);
+#endif
+            }
+#else
+            void *memory = ::operator new(size, std::align_val_t(alignment));
+#endif
+
+            mapped_bytes += size;
+
+            return memory;
+        }
+
+        void do_deallocate(void *ptr, size_t bytes, [[maybe_unused]] size_t alignment) override
+        {
+            size_t size = roundUp(bytes > 0 ? bytes : 1);
+
+            mapped_bytes -= size;
+
+#if defined(__unix__) || defined(__APPLE__)
+            // Explicit huge page mappings can only be unmapped in whole pages, which size already is
+            ::munmap(ptr, size);
+#else
+            ::operator delete(ptr, std::align_val_t(alignment));
+#endif
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+
+        size_t mapped_bytes = 0;
+        size_t huge_tlb_bytes = 0;
+    };
+}
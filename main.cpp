@@ -76,16 +76,28 @@ int main()
 
     constexpr uint NUM_E = 1'000'000u;
 
+    std::vector<Position> positions;
+    std::vector<vecs::Entity> moving;
+    std::vector<Velocity> velocities;
+
+    positions.reserve(NUM_E);
+
     for (auto i = 0u; i < NUM_E; i++)
     {
-        const auto entity = ecs.createEntity();
+        positions.push_back({i * 5.f, i * 1.f});
+    }
 
-        ecs.addComponent<Position>(entity, {i * 5.f, i * 1.f});
+    // Bulk spawn, every set gets reserved and filled in one pass
+    const vecs::EntityRange spawned = ecs.spawnBatch<Position>(positions);
 
-        if (i % 2 == 0)
-            ecs.addComponent<Velocity>(entity, {5 * 0.1f, i * 0.1f});
+    for (auto i = 0u; i < NUM_E; i += 2)
+    {
+        moving.push_back(spawned[i]);
+        velocities.push_back({5 * 0.1f, i * 0.1f});
     }
 
+    ecs.insertBatch<Velocity>(moving, velocities);
+
 
     for (size_t i = 0; i < 5 ; i++)
     {
@@ -0,0 +1,317 @@
+// Per system timing, entity counts and thread pool utilization of schedule runs. Recording is compiled in with VECS_PROFILE
+#pragma once
+#include <cinttypes>
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "thread_pool.h"
+
+namespace vecs
+{
+    constexpr uint32_t NO_SYSTEM = UINT32_MAX;
+
+    enum class ProfileEventKind : uint8_t
+    {
+        System, // One system run
+        Batch,  // One iteration over a range of the driving set, part of a system run
+        Wait    // A thread waiting for jobs it handed to the pool, jobs it ran in the meantime are included
+    };
+
+    struct ProfileEvent
+    {
+        uint64_t start_ns = 0; // Since the profiler got created
+        uint64_t duration_ns = 0;
+        uint64_t visited = 0; // Batch: entities of the driving set looked at
+        uint64_t matched = 0; // Batch: entities passed to the system
+        uint32_t system = NO_SYSTEM;
+        ProfileEventKind kind = ProfileEventKind::System;
+    };
+
+    /// @brief The last WINDOW samples of one value
+    class RollingStats
+    {
+    public:
+        static constexpr size_t WINDOW = 64;
+
+        inline void add(double sample)
+        {
+            samples[count % WINDOW] = sample;
+            count++;
+        }
+
+        inline size_t size() const
+        {
+            return static_cast<size_t>(std::min<uint64_t>(count, WINDOW));
+        }
+
+        inline double last() const
+        {
+            return count > 0 ? samples[(count - 1) % WINDOW] : 0.0;
+        }
+
+        double mean() const
+        {
+            double sum = 0.0;
+
+            for (size_t i = 0; i < size(); i++)
+                sum += samples[i];
+
+            return size() > 0 ? sum / size() : 0.0;
+        }
+
+        double min() const
+        {
+            return size() > 0 ? *std::min_element(samples, samples + size()) : 0.0;
+        }
+
+        double max() const
+        {
+            return size() > 0 ? *std::max_element(samples, samples + size()) : 0.0;
+        }
+
+    private:
+        double samples[WINDOW] = {};
+        uint64_t count = 0;
+    };
+
+    struct SystemProfile
+    {
+        std::string name;
+        RollingStats wall_us; // Per run
+        RollingStats visited; // Per run, entities of the driving set looked at
+        RollingStats matched; // Per run, entities passed to the system
+    };
+
+    struct WorkerProfile
+    {
+        RollingStats busy_us; // Per frame, running jobs
+        RollingStats idle_us; // Per frame, looking for jobs or asleep
+    };
+
+    /// @brief Every thread records into its own fixed size ring, so recording takes no locks. endFrame folds the rings into rolling
+    /// per system stats once no system runs anymore. Without VECS_PROFILE nothing gets recorded and all stats stay empty
+    class Profiler
+    {
+    public:
+        static constexpr size_t BUFFER_CAPACITY = 1 << 14; // Events per thread kept for the trace
+
+        /// @param worker_count Pool workers, they get slots [0, worker_count), the thread that runs schedules gets the last one
+        Profiler(size_t worker_count) : buffers(worker_count + 1), workers(worker_count), last_busy_ns(worker_count, 0), last_idle_ns(worker_count, 0), epoch(std::chrono::steady_clock::now()) {}
+
+        inline uint64_t now() const
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+        }
+
+        /// @brief Only the thread that owns slot may record into it
+        void record(size_t slot, const ProfileEvent &event)
+        {
+            ThreadBuffer &buffer = buffers[slot];
+
+            if (buffer.events.empty())
+                buffer.events.resize(BUFFER_CAPACITY);
+
+            buffer.events[buffer.written % BUFFER_CAPACITY] = event;
+            buffer.written++;
+        }
+
+        /// @brief System the calling thread works for, parallel helpers take it over from the thread that split the work
+        static inline uint32_t currentSystem()
+        {
+            return current_system;
+        }
+
+        static inline void setCurrentSystem(uint32_t system)
+        {
+            current_system = system;
+        }
+
+        /// @brief Folds all events recorded since the last call into the stats, must not run while systems run
+        void endFrame(const thread_pool::ThreadPool &pool)
+        {
+            std::fill(frame_visited.begin(), frame_visited.end(), 0);
+            std::fill(frame_matched.begin(), frame_matched.end(), 0);
+            std::fill(frame_ran.begin(), frame_ran.end(), false);
+
+            double wait_us = 0.0;
+
+            for (ThreadBuffer &buffer : buffers)
+            {
+                uint64_t first = std::max(buffer.folded, buffer.written > BUFFER_CAPACITY ? buffer.written - BUFFER_CAPACITY : uint64_t(0));
+
+                for (uint64_t i = first; i < buffer.written; i++)
+                {
+                    const ProfileEvent &event = buffer.events[i % BUFFER_CAPACITY];
+
+                    if (event.kind == ProfileEventKind::Wait)
+                    {
+                        wait_us += event.duration_ns / 1000.0;
+                        continue;
+                    }
+
+                    if (event.system == NO_SYSTEM)
+                        continue;
+
+                    growSystems(event.system);
+
+                    if (event.kind == ProfileEventKind::System)
+                    {
+                        systems[event.system].wall_us.add(event.duration_ns / 1000.0);
+                        frame_ran[event.system] = true;
+                    }
+                    else
+                    {
+                        frame_visited[event.system] += event.visited;
+                        frame_matched[event.system] += event.matched;
+                    }
+                }
+
+                buffer.folded = buffer.written;
+            }
+
+            for (size_t system = 0; system < systems.size(); system++)
+            {
+                if (!frame_ran[system])
+                    continue;
+
+                systems[system].visited.add(static_cast<double>(frame_visited[system]));
+                systems[system].matched.add(static_cast<double>(frame_matched[system]));
+            }
+
+            wait.add(wait_us);
+
+            for (size_t i = 0; i < workers.size() && i < pool.threadCount(); i++)
+            {
+                uint64_t busy_ns = pool.workerBusyNanoseconds(i);
+                uint64_t idle_ns = pool.workerIdleNanoseconds(i);
+
+                workers[i].busy_us.add((busy_ns - last_busy_ns[i]) / 1000.0);
+                workers[i].idle_us.add((idle_ns - last_idle_ns[i]) / 1000.0);
+
+                last_busy_ns[i] = busy_ns;
+                last_idle_ns[i] = idle_ns;
+            }
+
+            frames++;
+        }
+
+        void setSystemName(uint32_t system, std::string name)
+        {
+            growSystems(system);
+            systems[system].name = std::move(name);
+        }
+
+        /// @return nullptr if the system never ran while profiling
+        inline const SystemProfile *systemStats(uint32_t system) const
+        {
+            return system < systems.size() ? &systems[system] : nullptr;
+        }
+
+        /// @brief Per frame, time threads spent waiting for work they handed out
+        inline const RollingStats &waitStats() const
+        {
+            return wait;
+        }
+
+        inline const WorkerProfile &workerStats(size_t worker) const
+        {
+            return workers[worker];
+        }
+
+        inline size_t workerCount() const
+        {
+            return workers.size();
+        }
+
+        inline uint64_t frameCount() const
+        {
+            return frames;
+        }
+
+        /// @brief Writes the events still held by the rings as Chrome trace_event JSON (chrome://tracing, Perfetto)
+        void writeChromeTrace(std::ostream &out) const
+        {
+            out << "{\"traceEvents\": [\n";
+
+            bool first_event = true;
+
+            for (size_t slot = 0; slot < buffers.size(); slot++)
+            {
+                out << (first_event ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << slot
+                    << ", \"args\": {\"name\": \"" << (slot < workers.size() ? "worker " + std::to_string(slot) : std::string("main")) << "\"}}";
+
+                first_event = false;
+
+                const ThreadBuffer &buffer = buffers[slot];
+                uint64_t first = buffer.written > BUFFER_CAPACITY ? buffer.written - BUFFER_CAPACITY : 0;
+
+                for (uint64_t i = first; i < buffer.written; i++)
+                {
+                    const ProfileEvent &event = buffer.events[i % BUFFER_CAPACITY];
+
+                    out << ",\n{\"name\": \"" << eventName(event) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << slot
+                        << ", \"ts\": " << event.start_ns / 1000.0 << ", \"dur\": " << event.duration_ns / 1000.0 << ", \"args\": {";
+
+                    if (event.system != NO_SYSTEM)
+                        out << "\"system\": " << event.system << (event.kind == ProfileEventKind::Batch ? ", " : "");
+
+                    if (event.kind == ProfileEventKind::Batch)
+                        out << "\"visited\": " << event.visited << ", \"matched\": " << event.matched;
+
+                    out << "}}";
+                }
+            }
+
+            out << "\n]}\n";
+        }
+
+    private:
+        struct alignas(64) ThreadBuffer
+        {
+            std::vector<ProfileEvent> events; // Ring, allocated on the first event
+            uint64_t written = 0;
+            uint64_t folded = 0; // Events before this went into the stats
+        };
+
+        std::string eventName(const ProfileEvent &event) const
+        {
+            if (event.kind == ProfileEventKind::Wait)
+                return "wait";
+
+            std::string name = event.system < systems.size() && !systems[event.system].name.empty() ? systems[event.system].name : "system " + std::to_string(event.system);
+
+            return event.kind == ProfileEventKind::Batch ? name + " batch" : name;
+        }
+
+        void growSystems(uint32_t system)
+        {
+            if (system >= systems.size())
+            {
+                systems.resize(system + 1);
+                frame_visited.resize(system + 1, 0);
+                frame_matched.resize(system + 1, 0);
+                frame_ran.resize(system + 1, false);
+            }
+        }
+
+        static inline thread_local uint32_t current_system = NO_SYSTEM;
+
+        std::vector<ThreadBuffer> buffers;
+
+        std::vector<SystemProfile> systems;
+        std::vector<uint64_t> frame_visited;
+        std::vector<uint64_t> frame_matched;
+        std::vector<bool> frame_ran;
+
+        RollingStats wait;
+        std::vector<WorkerProfile> workers;
+        std::vector<uint64_t> last_busy_ns;
+        std::vector<uint64_t> last_idle_ns;
+
+        uint64_t frames = 0;
+
+        std::chrono::steady_clock::time_point epoch;
+    };
+}
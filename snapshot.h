@@ -0,0 +1,267 @@
+// Binary snapshot streams: 64 byte aligned blocks in host byte order, plus stable component ids and file mapping
+#pragma once
+#include <cinttypes>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vecs
+{
+    constexpr size_t SNAPSHOT_ALIGN = 64;
+
+    /// @brief Id of a component or resource that does not depend on registration order or build, FNV-1a of its name
+    inline constexpr uint64_t stableTypeId(std::string_view name)
+    {
+        uint64_t hash = 14695981039346656037ull;
+
+        for (char c : name)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    /// @brief Appends to a byte buffer, blocks that are loaded in bulk start on SNAPSHOT_ALIGN offsets
+    class SnapshotWriter
+    {
+    public:
+        inline void write(const void *data, size_t size)
+        {
+            const unsigned char *bytes = static_cast<const unsigned char *>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+
+        template <typename T>
+        inline void writeValue(const T &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Write non trivial values field by field");
+            write(&value, sizeof(T));
+        }
+
+        inline void writeString(std::string_view text)
+        {
+            writeValue(static_cast<uint64_t>(text.size()));
+            write(text.data(), text.size());
+        }
+
+        /// @brief Pads with zeros up to the next aligned offset
+        inline void align()
+        {
+            buffer.resize((buffer.size() + SNAPSHOT_ALIGN - 1) & ~(SNAPSHOT_ALIGN - 1), 0);
+        }
+
+        /// @brief Reserves room for a T that gets filled in later with patch, e.g. a size that is only known afterwards
+        template <typename T>
+        inline size_t reserveValue()
+        {
+            size_t offset = buffer.size();
+            buffer.resize(offset + sizeof(T), 0);
+            return offset;
+        }
+
+        template <typename T>
+        inline void patch(size_t offset, const T &value)
+        {
+            std::memcpy(buffer.data() + offset, &value, sizeof(T));
+        }
+
+        inline size_t size() const
+        {
+            return buffer.size();
+        }
+
+        inline const std::vector<unsigned char> &bytes() const
+        {
+            return buffer;
+        }
+
+        inline void clear()
+        {
+            buffer.clear();
+        }
+
+    private:
+        std::vector<unsigned char> buffer;
+    };
+
+    /// @brief Reads from memory it does not own. A read past the end sets failed and returns zeros, callers check ok() once at the end
+    class SnapshotReader
+    {
+    public:
+        SnapshotReader(const void *data, size_t size) : data(static_cast<const unsigned char *>(data)), size(size) {}
+
+        inline void read(void *out, size_t count)
+        {
+            const unsigned char *bytes = take(count);
+
+            if (bytes != nullptr)
+                std::memcpy(out, bytes, count);
+            else
+                std::memset(out, 0, count);
+        }
+
+        template <typename T>
+        inline T readValue()
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Read non trivial values field by field");
+
+            T value;
+            read(&value, sizeof(T));
+            return value;
+        }
+
+        inline std::string readString()
+        {
+            uint64_t length = readValue<uint64_t>();
+            const unsigned char *bytes = take(length);
+
+            return bytes != nullptr ? std::string(reinterpret_cast<const char *>(bytes), length) : std::string();
+        }
+
+        /// @brief Points into the source, so aligned blocks can be used or copied in place
+        /// @return nullptr if fewer than count bytes are left
+        inline const unsigned char *take(size_t count)
+        {
+            if (failed || count > size - offset)
+            {
+                failed = true;
+                return nullptr;
+            }
+
+            const unsigned char *bytes = data + offset;
+            offset += count;
+
+            return bytes;
+        }
+
+        inline void align()
+        {
+            size_t aligned = (offset + SNAPSHOT_ALIGN - 1) & ~(SNAPSHOT_ALIGN - 1);
+            offset = aligned <= size ? aligned : size;
+        }
+
+        inline void skip(size_t count)
+        {
+            take(count);
+        }
+
+        inline size_t position() const
+        {
+            return offset;
+        }
+
+        inline bool ok() const
+        {
+            return !failed;
+        }
+
+    private:
+        const unsigned char *data;
+        size_t size;
+        size_t offset = 0;
+        bool failed = false;
+    };
+
+    /// @brief Read only view of a whole file: mapped where the platform supports it, read into memory otherwise
+    class MappedFile
+    {
+    public:
+        MappedFile(const std::string &path)
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            int fd = ::open(path.c_str(), O_RDONLY);
+
+            if (fd < 0)
+                return;
+
+            struct stat info;
+
+            if (::fstat(fd, &info) == 0 && info.st_size > 0)
+            {
+                void *mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (mapped != MAP_FAILED)
+                {
+                    mapping = mapped;
+                    bytes = static_cast<const unsigned char *>(mapped);
+                    length = static_cast<size_t>(info.st_size);
+                }
+            }
+
+            ::close(fd);
+#else
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+            if (!file)
+                return;
+
+            fallback.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+
+            if (file.read(reinterpret_cast<char *>(fallback.data()), fallback.size()))
+            {
+                bytes = fallback.data();
+                length = fallback.size();
+            }
+#endif
+        }
+
+        ~MappedFile()
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            if (mapping != nullptr)
+                ::munmap(mapping, length);
+#endif
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        inline const unsigned char *data() const
+        {
+            return bytes;
+        }
+
+        inline size_t size() const
+        {
+            return length;
+        }
+
+        inline bool isOpen() const
+        {
+            return bytes != nullptr;
+        }
+
+    private:
+        const unsigned char *bytes = nullptr;
+        size_t length = 0;
+
+        void *mapping = nullptr;
+        std::vector<unsigned char> fallback;
+    };
+
+    /// @brief Writes all bytes of writer to path
+    inline bool writeFile(const std::string &path, const SnapshotWriter &writer)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+        if (!file)
+            return false;
+
+        file.write(reinterpret_cast<const char *>(writer.bytes().data()), static_cast<std::streamsize>(writer.size()));
+
+        return static_cast<bool>(file);
+    }
+}
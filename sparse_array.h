@@ -0,0 +1,154 @@
+// Paged entity index -> dense index map
+#pragma once
+#include <cinttypes>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include "entity.h"
+#include "aligned_allocator.h"
+
+namespace vecs
+{
+    static_assert(NO_ENTITY == UINT32_MAX, "Pages get filled bytewise with NO_ENTITY");
+
+    /// @brief Sparse part of a sparse set. Pages are allocated when the first entity in their index range gets a value,
+    /// pages that were never written all point to one shared read only page full of NO_ENTITY.
+    /// Memory grows with the touched index ranges instead of the highest index.
+    class SparseArray
+    {
+    public:
+        static constexpr uint32_t PAGE_BITS = 12;
+        static constexpr uint32_t PAGE_SIZE = 1u << PAGE_BITS; // Entries per page, 16 KiB
+        static constexpr uint32_t PAGE_MASK = PAGE_SIZE - 1;
+
+        SparseArray() = default;
+
+        /// @param resource Where pages and the page table live, nullptr for operator new
+        explicit SparseArray(std::pmr::memory_resource *resource) : pages(AlignedAllocator<uint32_t *>(resource)), resource(resource) {}
+
+        ~SparseArray()
+        {
+            AlignedAllocator<uint32_t> page_allocator(resource);
+
+            for (uint32_t *page : pages)
+                if (page != emptyPage())
+                    page_allocator.deallocate(page, PAGE_SIZE);
+        }
+
+        SparseArray(const SparseArray &) = delete;
+        SparseArray &operator=(const SparseArray &) = delete;
+
+        SparseArray(SparseArray &&other) noexcept : pages(std::move(other.pages)), page_count(other.page_count), resource(other.resource)
+        {
+            other.pages.clear();
+            other.page_count = 0;
+        }
+
+        /// @return Dense index or NO_ENTITY
+        inline uint32_t get(uint32_t index) const
+        {
+            uint32_t page = index >> PAGE_BITS;
+
+            if (page >= pages.size())
+                return NO_ENTITY;
+
+            return pages[page][index & PAGE_MASK];
+        }
+
+        /// @brief Unchecked lookup, index must be covered by the page table (true for every index that holds a value)
+        inline uint32_t operator[](uint32_t index) const
+        {
+            return pages[index >> PAGE_BITS][index & PAGE_MASK];
+        }
+
+        inline bool contains(uint32_t index) const
+        {
+            return get(index) != NO_ENTITY;
+        }
+
+        inline void set(uint32_t index, uint32_t dense_index)
+        {
+            uint32_t page = index >> PAGE_BITS;
+
+            if (page >= pages.size())
+                pages.resize(page + 1, emptyPage());
+
+            if (pages[page] == emptyPage())
+                allocatePage(page);
+
+            pages[page][index & PAGE_MASK] = dense_index;
+        }
+
+        /// @brief Clears the value, never allocates
+        inline void reset(uint32_t index)
+        {
+            uint32_t page = index >> PAGE_BITS;
+
+            if (page < pages.size() && pages[page] != emptyPage())
+                pages[page][index & PAGE_MASK] = NO_ENTITY;
+        }
+
+        /// @brief Grows the page table up front so indices below index_count do not reallocate it. Pages stay lazy
+        void reserve(uint32_t index_count)
+        {
+            size_t page_total = (size_t(index_count) + PAGE_MASK) >> PAGE_BITS;
+
+            if (page_total > pages.size())
+                pages.resize(page_total, emptyPage());
+        }
+
+        /// @brief Calls func(page_index, entries) for every owned page, entries holds PAGE_SIZE values
+        template <typename Func>
+        void forEachPage(Func &&func) const
+        {
+            for (uint32_t page = 0; page < pages.size(); page++)
+                if (pages[page] != emptyPage())
+                    func(page, static_cast<const uint32_t *>(pages[page]));
+        }
+
+        /// @brief Overwrites a whole page with PAGE_SIZE entries
+        void setPage(uint32_t page, const uint32_t *entries)
+        {
+            if (page >= pages.size())
+                pages.resize(page + 1, emptyPage());
+
+            if (pages[page] == emptyPage())
+                allocatePage(page);
+
+            std::memcpy(pages[page], entries, PAGE_SIZE * sizeof(uint32_t));
+        }
+
+        /// @brief Bytes owned by this array
+        inline size_t memoryUsage() const
+        {
+            return pages.capacity() * sizeof(uint32_t *) + size_t(page_count) * PAGE_SIZE * sizeof(uint32_t);
+        }
+
+    private:
+        void allocatePage(uint32_t page)
+        {
+            uint32_t *data = AlignedAllocator<uint32_t>(resource).allocate(PAGE_SIZE);
+            std::memset(data, 0xFF, PAGE_SIZE * sizeof(uint32_t)); // NO_ENTITY
+
+            pages[page] = data;
+            page_count++;
+        }
+
+        static inline uint32_t *emptyPage()
+        {
+            static uint32_t *page = []()
+            {
+                static uint32_t data[PAGE_SIZE];
+                std::memset(data, 0xFF, sizeof(data));
+                return data;
+            }();
+
+            return page;
+        }
+
+        StorageVector<uint32_t *> pages;
+        uint32_t page_count = 0; // Owned pages
+
+        std::pmr::memory_resource *resource = nullptr;
+    };
+}
@@ -1,24 +1,247 @@
 // my ThreadPool Implementation
 #pragma once
 #include <cinttypes>
+#include <cstring>
 #include <thread>
-#include <queue>
 #include <vector>
-#include <functional>
+#include <memory>
+#include <new>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
-#include <future>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#ifdef VECS_PROFILE
+#include <chrono>
+#endif
 
 namespace thread_pool
 {
+    /// @brief Type erased void() callable with inline storage. Small trivially copyable callables (pointer / reference captures)
+    /// are stored in place, everything else gets boxed on the heap once.
+    class Job
+    {
+    public:
+        static constexpr size_t INLINE_SIZE = 56;
+
+        Job() = default;
+
+        template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Job>>>
+        Job(F &&func)
+        {
+            using Func = std::decay_t<F>;
+
+            if constexpr (sizeof(Func) <= INLINE_SIZE && alignof(Func) <= alignof(uint64_t) && std::is_trivially_copyable_v<Func>)
+            {
+                new (storage) Func(std::forward<F>(func));
+
+                invoke_fn = [](unsigned char *storage)
+                {
+                    (*reinterpret_cast<Func *>(storage))();
+                };
+            }
+            else
+            {
+                Func *boxed = new Func(std::forward<F>(func));
+                std::memcpy(storage, &boxed, sizeof(boxed));
+
+                invoke_fn = [](unsigned char *storage)
+                {
+                    Func *boxed;
+                    std::memcpy(&boxed, storage, sizeof(boxed));
+
+                    (*boxed)();
+                    delete boxed;
+                };
+            }
+        }
+
+        /// @brief Runs the job, a job must run exactly once
+        inline void operator()()
+        {
+            invoke_fn(storage);
+        }
+
+        inline explicit operator bool() const
+        {
+            return invoke_fn != nullptr;
+        }
+
+    private:
+        void (*invoke_fn)(unsigned char *) = nullptr;
+        alignas(uint64_t) unsigned char storage[INLINE_SIZE];
+    };
+
+    static_assert(sizeof(Job) == 64 && std::is_trivially_copyable_v<Job>, "Jobs get copied word by word between threads");
+
+    /// @brief Fixed capacity Chase-Lev deque. The owner pushes / pops at the bottom, other threads steal from the top.
+    class WorkStealingDeque
+    {
+    public:
+        static constexpr size_t CAPACITY = 1024; // Power of two
+        static constexpr size_t WORDS = sizeof(Job) / sizeof(uint64_t);
+
+        /// @brief Owner only. Returns false when full
+        bool push(const Job &job)
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+
+            if (b - t >= static_cast<int64_t>(CAPACITY))
+                return false;
+
+            store(slots[b & MASK], job);
+
+            bottom.store(b + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /// @brief Owner only, takes the newest job
+        bool pop(Job &out)
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            int64_t t = top.load(std::memory_order_relaxed);
+
+            if (t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            load(slots[b & MASK], out);
+
+            if (t == b)
+            {
+                // Last job, race against thieves
+                bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+
+                return won;
+            }
+
+            return true;
+        }
+
+        /// @brief Any thread, takes the oldest job
+        bool steal(Job &out)
+        {
+            int64_t t = top.load(std::memory_order_acquire);
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            int64_t b = bottom.load(std::memory_order_acquire);
+
+            if (t >= b)
+                return false;
+
+            load(slots[t & MASK], out);
+
+            return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr int64_t MASK = CAPACITY - 1;
+
+        // Slots are atomic words, a thief may read a slot while losing the race for it
+        struct Slot
+        {
+            std::atomic<uint64_t> words[WORDS];
+        };
+
+        static inline void store(Slot &slot, const Job &job)
+        {
+            uint64_t words[WORDS];
+            std::memcpy(words, &job, sizeof(Job));
+
+            for (size_t i = 0; i < WORDS; i++)
+                slot.words[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        static inline void load(const Slot &slot, Job &job)
+        {
+            uint64_t words[WORDS];
+
+            for (size_t i = 0; i < WORDS; i++)
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+
+            std::memcpy(static_cast<void *>(&job), words, sizeof(Job));
+        }
+
+        alignas(64) std::atomic<int64_t> top{0};
+        alignas(64) std::atomic<int64_t> bottom{0};
+        alignas(64) Slot slots[CAPACITY];
+    };
+
+    /// @brief Growable FIFO ring of jobs. Unlike std::deque it keeps its memory, so steady enqueueing does not allocate
+    class JobRing
+    {
+    public:
+        void push(const Job &job)
+        {
+            if (count == jobs.size())
+                grow();
+
+            jobs[(head + count) & (jobs.size() - 1)] = job;
+            count++;
+        }
+
+        bool pop(Job &out)
+        {
+            if (count == 0)
+                return false;
+
+            out = jobs[head];
+            head = (head + 1) & (jobs.size() - 1);
+            count--;
+
+            return true;
+        }
+
+    private:
+        void grow()
+        {
+            std::vector<Job> larger(jobs.empty() ? 256 : jobs.size() * 2);
+
+            for (size_t i = 0; i < count; i++)
+                larger[i] = jobs[(head + i) & (jobs.size() - 1)];
+
+            jobs = std::move(larger);
+            head = 0;
+        }
+
+        std::vector<Job> jobs; // Power of two size
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+    /// @brief Work stealing pool. Workers push to and pop from their own deque and steal from the others when empty,
+    /// jobs from outside the pool go through a shared injection queue. Waiting threads can run jobs themselves.
     class ThreadPool
     {
     public:
+        static constexpr size_t NO_WORKER = SIZE_MAX;
+        static constexpr int SPIN_COUNT = 64; // Failed looks for a job before a thread goes to sleep
+
         ThreadPool(size_t thread_count = std::thread::hardware_concurrency()) : stop_flag(false)
         {
             for (size_t i = 0; i < thread_count; i++)
             {
-                workers.emplace_back(&ThreadPool::workerLoop, this);
+                queues.push_back(std::make_unique<WorkStealingDeque>());
+            }
+
+#ifdef VECS_PROFILE
+            worker_times = std::make_unique<WorkerTimes[]>(thread_count);
+#endif
+
+            for (size_t i = 0; i < thread_count; i++)
+            {
+                workers.emplace_back(&ThreadPool::workerLoop, this, i);
             }
         }
 
@@ -27,21 +250,118 @@ namespace thread_pool
             stop();
         }
 
-        void enqueue(std::function<void()> job)
+        void enqueue(Job job)
+        {
+            pending.fetch_add(1, std::memory_order_seq_cst);
+
+            if (current_pool != this || !queues[current_index]->push(job))
+            {
+                std::unique_lock<std::mutex> lock(injection_mutex);
+                injection_queue.push(job);
+            }
+
+            if (sleeping.load(std::memory_order_seq_cst) > 0)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(sleep_mutex);
+                }
+
+                condition.notify_one();
+            }
+
+            wakeParked();
+        }
+
+        /// @brief Runs one queued job on the calling thread
+        /// @return false if no job could be found
+        bool runPendingJob()
+        {
+            Job job;
+
+            if (!findJob(job, current_pool == this ? current_index : NO_WORKER))
+                return false;
+
+            job();
+            return true;
+        }
+
+        /// @brief Works on queued jobs until done() returns true
+        template <typename Pred>
+        void waitUntil(Pred &&done)
+        {
+            while (!done())
+            {
+                if (!runPendingJob())
+                    std::this_thread::yield();
+            }
+        }
+
+        /// @brief Blocks until done() returns true or new jobs got queued, for waiters that found nothing to run. Whoever
+        /// makes done() true has to call wakeParked afterwards
+        template <typename Pred>
+        void park(Pred &&done)
         {
+            parked.fetch_add(1, std::memory_order_seq_cst);
 
             {
-                std::unique_lock<std::mutex> lock(queue_mutex);
-                job_queue.push(std::move(job));
+                std::unique_lock<std::mutex> lock(park_mutex);
+                park_condition.wait(lock, [&]()
+                                    { return done() || pending.load(std::memory_order_seq_cst) > 0; });
             }
 
-            condition.notify_one();
+            parked.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /// @brief Lets parked threads recheck their condition, only a load if nobody is parked
+        inline void wakeParked()
+        {
+            if (parked.load(std::memory_order_seq_cst) > 0)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(park_mutex);
+                }
+
+                park_condition.notify_all();
+            }
+        }
+
+        inline size_t threadCount() const
+        {
+            return workers.size();
+        }
+
+        /// @brief Nanoseconds worker index spent running jobs, only counted with VECS_PROFILE
+        inline uint64_t workerBusyNanoseconds(size_t index) const
+        {
+#ifdef VECS_PROFILE
+            return worker_times[index].busy_ns.load(std::memory_order_relaxed);
+#else
+            (void)index;
+            return 0;
+#endif
+        }
+
+        /// @brief Nanoseconds worker index spent looking for jobs or asleep, only counted with VECS_PROFILE
+        inline uint64_t workerIdleNanoseconds(size_t index) const
+        {
+#ifdef VECS_PROFILE
+            return worker_times[index].idle_ns.load(std::memory_order_relaxed);
+#else
+            (void)index;
+            return 0;
+#endif
+        }
+
+        /// @brief Index of the calling worker thread, NO_WORKER if the caller is not part of this pool
+        inline size_t currentWorkerIndex() const
+        {
+            return current_pool == this ? current_index : NO_WORKER;
         }
 
         void stop()
         {
             {
-                std::unique_lock<std::mutex> lock(queue_mutex);
+                std::unique_lock<std::mutex> lock(sleep_mutex);
                 stop_flag = true;
             }
 
@@ -56,30 +376,241 @@ namespace thread_pool
         }
 
     private:
-        void workerLoop()
+        bool findJob(Job &job, size_t own_index)
+        {
+            if (own_index != NO_WORKER && queues[own_index]->pop(job))
+            {
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            if (pending.load(std::memory_order_relaxed) <= 0)
+                return false;
+
+            {
+                std::unique_lock<std::mutex> lock(injection_mutex);
+
+                if (injection_queue.pop(job))
+                {
+                    pending.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+
+            size_t count = queues.size();
+            size_t start = own_index == NO_WORKER ? 0 : own_index + 1;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t victim = (start + i) % count;
+
+                if (victim != own_index && queues[victim]->steal(job))
+                {
+                    pending.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void workerLoop(size_t index)
         {
+            current_pool = this;
+            current_index = index;
+
+#ifdef VECS_PROFILE
+            auto idle_start = std::chrono::steady_clock::now();
+#endif
+
             while (true)
             {
-                std::function<void()> job;
+                Job job;
+                bool found = false;
+
+                for (int spin = 0; spin < SPIN_COUNT && !found; spin++)
+                {
+                    found = findJob(job, index);
+
+                    if (!found)
+                        std::this_thread::yield();
+                }
+
+                if (found)
                 {
-                    std::unique_lock<std::mutex> lock(queue_mutex);
-                    condition.wait(lock, [&]()
-                                   { return stop_flag || !job_queue.empty(); });
+#ifdef VECS_PROFILE
+                    auto busy_start = std::chrono::steady_clock::now();
+                    addTime(worker_times[index].idle_ns, busy_start - idle_start);
 
-                    if (stop_flag || job_queue.empty())
-                        return;
+                    job();
 
-                    job = std::move(job_queue.front());
-                    job_queue.pop();
+                    idle_start = std::chrono::steady_clock::now();
+                    addTime(worker_times[index].busy_ns, idle_start - busy_start);
+#else
+                    job();
+#endif
+                    continue;
                 }
-                job();
+
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+
+                sleeping.fetch_add(1, std::memory_order_seq_cst);
+                condition.wait(lock, [&]()
+                               { return stop_flag || pending.load(std::memory_order_seq_cst) > 0; });
+                sleeping.fetch_sub(1, std::memory_order_relaxed);
+
+                if (stop_flag && pending.load(std::memory_order_seq_cst) <= 0)
+                    return;
             }
         }
 
+#ifdef VECS_PROFILE
+        struct alignas(64) WorkerTimes
+        {
+            std::atomic<uint64_t> busy_ns{0};
+            std::atomic<uint64_t> idle_ns{0};
+        };
+
+        // Only the owning worker adds, anyone may read
+        static inline void addTime(std::atomic<uint64_t> &total, std::chrono::steady_clock::duration time)
+        {
+            uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+            total.store(total.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        }
+
+        std::unique_ptr<WorkerTimes[]> worker_times;
+#endif
+
+        static inline thread_local ThreadPool *current_pool = nullptr;
+        static inline thread_local size_t current_index = NO_WORKER;
+
         std::vector<std::thread> workers;
-        std::queue<std::function<void()>> job_queue;
-        std::mutex queue_mutex;
+        std::vector<std::unique_ptr<WorkStealingDeque>> queues;
+
+        JobRing injection_queue;
+        std::mutex injection_mutex;
+
+        alignas(64) std::atomic<int64_t> pending{0}; // Queued but not yet taken jobs
+        std::atomic<int> sleeping{0};
+
+        std::mutex sleep_mutex;
         std::condition_variable condition;
         std::atomic<bool> stop_flag;
+
+        // Threads waiting for a TaskGroup with nothing left to run, separate from sleeping workers
+        std::atomic<int> parked{0};
+        std::mutex park_mutex;
+        std::condition_variable park_condition;
     };
+
+    /// @brief Fork join over a pool: spawn queues tasks, wait runs queued jobs on the calling thread until all tasks
+    /// of the group are done. Tasks may spawn more tasks into the same group. When there is nothing left to run, the waiter
+    /// spins a little and then parks, so a batch only touches a mutex if the waiter really has to sleep
+    class TaskGroup
+    {
+    public:
+        explicit TaskGroup(ThreadPool &pool) : pool(pool) {}
+
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        ~TaskGroup()
+        {
+            wait();
+        }
+
+        /// @brief func gets copied into the job, pointer and reference captures up to 40 bytes are stored without allocating
+        template <typename Func>
+        void spawn(Func &&func)
+        {
+            outstanding.fetch_add(1, std::memory_order_relaxed);
+
+            // Nothing of the group may be touched after the last decrement, the waiter can return at once
+            pool.enqueue([group = this, pool = &pool, func = std::forward<Func>(func)]() mutable
+                         {
+                             func();
+
+                             if (group->outstanding.fetch_sub(1, std::memory_order_seq_cst) == 1)
+                                 pool->wakeParked(); });
+        }
+
+        /// @brief Returns once every spawned task finished, works on queued jobs of any group meanwhile
+        void wait()
+        {
+            int idle_spins = 0;
+
+            while (!isDone())
+            {
+                if (pool.runPendingJob())
+                {
+                    idle_spins = 0;
+                    continue;
+                }
+
+                if (++idle_spins < ThreadPool::SPIN_COUNT)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                pool.park([this]()
+                          { return isDone(); });
+
+                idle_spins = 0;
+            }
+        }
+
+        inline bool isDone() const
+        {
+            return outstanding.load(std::memory_order_seq_cst) == 0;
+        }
+
+    private:
+        ThreadPool &pool;
+        std::atomic<size_t> outstanding{0};
+    };
+
+    /// @brief Calls body(chunk_begin, chunk_end) over [begin, end) in chunks of grain on the pool and the calling thread.
+    /// Chunks get claimed from a shared counter, so uneven chunks balance out. Returns when all chunks are done
+    template <typename Body>
+    void parallelFor(ThreadPool &pool, size_t begin, size_t end, size_t grain, Body &&body)
+    {
+        if (begin >= end)
+            return;
+
+        grain = grain > 0 ? grain : 1;
+
+        size_t count = end - begin;
+        size_t chunk_count = (count + grain - 1) / grain;
+
+        if (chunk_count == 1 || pool.threadCount() == 0)
+        {
+            body(begin, end);
+            return;
+        }
+
+        std::atomic<size_t> next_chunk{0};
+
+        auto work = [&next_chunk, &body, begin, end, grain, chunk_count]()
+        {
+            size_t chunk;
+            while ((chunk = next_chunk.fetch_add(1, std::memory_order_relaxed)) < chunk_count)
+            {
+                size_t chunk_begin = begin + chunk * grain;
+                body(chunk_begin, std::min(chunk_begin + grain, end));
+            }
+        };
+
+        TaskGroup group(pool);
+
+        // Helpers that start after all chunks are taken return at once
+        size_t helpers = std::min(pool.threadCount(), chunk_count - 1);
+
+        for (size_t i = 0; i < helpers; i++)
+            group.spawn([&work]()
+                        { work(); });
+
+        work();
+        group.wait();
+    }
 }
@@ -5,29 +5,106 @@
 #include <typeindex>
 #include <memory>
 #include <cassert>
-#include <unordered_set>
 #include <type_traits>
 #include <functional>
 #include <thread>
+#include <tuple>
+#include <array>
+#include <map>
+#include <algorithm>
+#include <queue>
+#include <chrono>
+#include <atomic>
+#include <string_view>
 #include "dynamic_bitset.h"
 #include "thread_pool.h"
+#include "entity.h"
+#include "component_mask.h"
+#include "sparse_array.h"
+#include "aligned_allocator.h"
+#include "archetype.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "dirty_set.h"
+#include "huge_page_resource.h"
 
 #include <cassert>
 
 namespace vecs
 {
-    using Entity = uint32_t;
-    constexpr Entity NO_ENTITY = UINT32_MAX;
-
     class Ecs; // Forward Decl
 
+    /// @brief How a world lays out its components
+    enum class StorageMode
+    {
+        SparseSet, // One sparse set per component type, cheap add / remove
+        Archetype  // Entities with the same component set share chunks, fast multi component iteration
+    };
+
+    /// @brief Non owning view of contiguous elements, converts from std::vector and arrays
+    template <typename T>
+    struct Span
+    {
+        T *data = nullptr;
+        size_t count = 0;
+
+        Span() = default;
+        Span(T *data, size_t count) : data(data), count(count) {}
+
+        template <typename Container, typename = decltype(std::declval<Container &>().data())>
+        Span(Container &container) : data(container.data()), count(container.size()) {}
+
+        template <size_t N>
+        Span(T (&array)[N]) : data(array), count(N) {}
+
+        inline T *begin() const { return data; }
+        inline T *end() const { return data + count; }
+        inline size_t size() const { return count; }
+        inline T &operator[](size_t i) const { return data[i]; }
+    };
+
+    /// @brief Set of systems plus ordering constraints. Gets compiled into a dependency graph on first run,
+    /// the graph is cached until systems or constraints change
     struct Schedule
     {
 
         Schedule() {};
         ~Schedule() = default;
 
-        std::unordered_set<uint32_t> systems;
+        /// @brief first always runs before second, even if they do not access the same data
+        void runBefore(uint32_t first, uint32_t second)
+        {
+            orderings.push_back({first, second});
+            dirty = true;
+        }
+
+        /// @brief first always runs after second, even if they do not access the same data
+        void runAfter(uint32_t first, uint32_t second)
+        {
+            runBefore(second, first);
+        }
+
+        inline const std::vector<uint32_t> &getSystems() const
+        {
+            return systems;
+        }
+
+    private:
+        friend class Ecs;
+
+        std::vector<uint32_t> systems;                         // Insertion order, conflicting systems run in this order
+        std::vector<std::pair<uint32_t, uint32_t>> orderings; // (first, second) system ids
+
+        // Compiled graph, all indices are into systems
+        bool dirty = true;
+        std::vector<std::vector<uint32_t>> successors;
+        std::vector<uint32_t> predecessor_counts;
+        std::vector<uint32_t> roots;
+        std::vector<uint32_t> topological_order;
+
+        std::vector<double> costs;      // Moving average of the run time of each system in microseconds
+        std::vector<double> priorities; // Longest path from a system to the end of the graph, the critical path goes first
+        std::unique_ptr<std::atomic<uint32_t>[]> pending_predecessors;
     };
 
     template <typename T>
@@ -42,6 +119,46 @@ namespace vecs
         using type = T;
     };
 
+    /// @brief Filter, keeps entities whose T got added since the system last ran. Not passed to the system
+    template <typename T>
+    struct Added
+    {
+        using type = T;
+    };
+
+    /// @brief Filter, keeps entities whose T got added or written since the system last ran. Not passed to the system
+    template <typename T>
+    struct Changed
+    {
+        using type = T;
+    };
+
+    /// @brief Filter, keeps entities that have T without fetching it
+    template <typename T>
+    struct With
+    {
+        using type = T;
+    };
+
+    /// @brief Filter, keeps entities that do not have T
+    template <typename T>
+    struct Without
+    {
+        using type = T;
+    };
+
+    /// @brief Optional<Read<T>> / Optional<Write<T>>, passed as const T * / T *, nullptr for entities without T
+    template <typename T>
+    struct Optional
+    {
+        using type = T;
+    };
+
+    /// @brief Placeholder argument of filter terms, gets dropped before the system is called
+    struct FilterTerm
+    {
+    };
+
     template <typename T>
     struct unwrap_component
     {
@@ -60,6 +177,36 @@ namespace vecs
         using type = T;
     };
 
+    template <typename T>
+    struct unwrap_component<Added<T>>
+    {
+        using type = T;
+    };
+
+    template <typename T>
+    struct unwrap_component<Changed<T>>
+    {
+        using type = T;
+    };
+
+    template <typename T>
+    struct unwrap_component<With<T>>
+    {
+        using type = T;
+    };
+
+    template <typename T>
+    struct unwrap_component<Without<T>>
+    {
+        using type = T;
+    };
+
+    template <typename T>
+    struct unwrap_component<Optional<T>>
+    {
+        using type = typename unwrap_component<T>::type;
+    };
+
     template <typename T>
     using component_t = typename unwrap_component<T>::type;
 
@@ -124,6 +271,101 @@ namespace vecs
     {
     };
 
+    template <typename T>
+    struct is_added : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct is_added<Added<T>> : std::true_type
+    {
+    };
+
+    template <typename T>
+    struct is_tick_filter : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct is_tick_filter<Added<T>> : std::true_type
+    {
+    };
+
+    template <typename T>
+    struct is_tick_filter<Changed<T>> : std::true_type
+    {
+    };
+
+    template <typename T>
+    struct is_with : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct is_with<With<T>> : std::true_type
+    {
+    };
+
+    template <typename T>
+    struct is_without : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct is_without<Without<T>> : std::true_type
+    {
+    };
+
+    template <typename T>
+    struct is_optional : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct is_optional<Optional<T>> : std::true_type
+    {
+        static_assert(is_read_or_write<T>::value, "Use Optional<Read<T>> or Optional<Write<T>>");
+    };
+
+    /// @brief Query term that only decides which entities match, it has no system argument
+    template <typename T>
+    struct is_filter : std::bool_constant<is_tick_filter<T>::value || is_with<T>::value || is_without<T>::value>
+    {
+    };
+
+    /// @brief Query term whose component every matching entity has
+    template <typename T>
+    struct is_component_term : std::bool_constant<is_read_or_write<T>::value || is_tick_filter<T>::value || is_with<T>::value>
+    {
+    };
+
+    /// @brief Query term that looks into the storage of its component
+    template <typename T>
+    struct needs_storage : std::bool_constant<is_component_term<T>::value || is_optional<T>::value>
+    {
+    };
+
+    /// @brief Component data a term reads, for the scheduler. Presence only filters do not count
+    template <typename T>
+    struct reads_component : std::bool_constant<is_read<T>::value || is_tick_filter<T>::value>
+    {
+    };
+
+    template <typename T>
+    struct reads_component<Optional<T>> : is_read<T>
+    {
+    };
+
+    template <typename T>
+    struct writes_component : is_write<T>
+    {
+    };
+
+    template <typename T>
+    struct writes_component<Optional<T>> : is_write<T>
+    {
+    };
+
     template <typename T>
     struct ResMut
     {
@@ -175,6 +417,9 @@ namespace vecs
     template <typename T>
     using resource_r = typename resourceRef<T>::type;
 
+    template <typename T>
+    struct SparseSet;
+
     template <typename T>
     struct isMutableResource : std::false_type
     {
@@ -210,18 +455,155 @@ namespace vecs
     {
     };
 
+    template <typename T>
+    struct is_query_term : std::bool_constant<is_component_term<T>::value || is_filter<T>::value || is_optional<T>::value || isResource<T>::value>
+    {
+    };
+
+    /// @brief Pointer to the sparse set a query term reads from, nullptr_t for resources
+    template <typename T>
+    using sparse_set_ptr_t = std::conditional_t<needs_storage<T>::value, SparseSet<component_t<T>> *, std::nullptr_t>;
+
+    /// @brief Change ticks of one system run. Changes newer than last_run are visible, writes get stamped with this_run
+    struct SystemTicks
+    {
+        uint32_t last_run = 0;
+        uint32_t this_run = 0;
+    };
+
+    /// @brief Wrap around safe, ticks are compared relative to each other
+    inline bool isNewerTick(uint32_t tick, uint32_t last_run)
+    {
+        return static_cast<int32_t>(tick - last_run) > 0;
+    }
+
     /// @brief Create a tuple with only types that passes a condition
     /// @tparam ...Ts
     template <template <typename> class Cond, typename... Ts>
     using filtered_tuple = decltype(std::tuple_cat(
         std::conditional_t<Cond<Ts>::value, std::tuple<Ts>, std::tuple<>>{}...));
 
+    /// @brief Type erased void(Ecs *, SystemTicks) with inline storage. Calling it is one indirect call on memory inside the
+    /// SystemWrapper, callables larger than INLINE_SIZE get boxed once when the system is added, never per frame
+    class SystemCallback
+    {
+    public:
+        static constexpr size_t INLINE_SIZE = 48;
+
+        SystemCallback() = default;
+
+        template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, SystemCallback>>>
+        SystemCallback(F &&func)
+        {
+            using Func = std::decay_t<F>;
+
+            if constexpr (sizeof(Func) <= INLINE_SIZE && alignof(Func) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<Func>)
+            {
+                new (storage) Func(std::forward<F>(func));
+
+                invoke_fn = [](void *storage, Ecs *ecs, SystemTicks ticks)
+                { (*static_cast<Func *>(storage))(ecs, ticks); };
+
+                manage_fn = [](Operation operation, void *dst, void *src)
+                {
+                    if (operation == Operation::Copy)
+                        new (dst) Func(*static_cast<const Func *>(src));
+                    else if (operation == Operation::Move)
+                        new (dst) Func(std::move(*static_cast<Func *>(src)));
+                    else
+                        static_cast<Func *>(dst)->~Func();
+                };
+            }
+            else
+            {
+                *reinterpret_cast<Func **>(storage) = new Func(std::forward<F>(func));
+
+                invoke_fn = [](void *storage, Ecs *ecs, SystemTicks ticks)
+                { (**static_cast<Func **>(storage))(ecs, ticks); };
+
+                manage_fn = [](Operation operation, void *dst, void *src)
+                {
+                    Func **dst_box = static_cast<Func **>(dst);
+                    Func **src_box = static_cast<Func **>(src);
+
+                    if (operation == Operation::Copy)
+                        *dst_box = new Func(**src_box);
+                    else if (operation == Operation::Move)
+                        *dst_box = std::exchange(*src_box, nullptr);
+                    else
+                        delete *dst_box;
+                };
+            }
+        }
+
+        SystemCallback(const SystemCallback &other) : invoke_fn(other.invoke_fn), manage_fn(other.manage_fn)
+        {
+            if (manage_fn != nullptr)
+                manage_fn(Operation::Copy, storage, const_cast<unsigned char *>(other.storage));
+        }
+
+        SystemCallback(SystemCallback &&other) noexcept : invoke_fn(other.invoke_fn), manage_fn(other.manage_fn)
+        {
+            if (manage_fn != nullptr)
+                manage_fn(Operation::Move, storage, other.storage);
+        }
+
+        SystemCallback &operator=(SystemCallback other) noexcept
+        {
+            reset();
+
+            invoke_fn = other.invoke_fn;
+            manage_fn = other.manage_fn;
+
+            if (manage_fn != nullptr)
+                manage_fn(Operation::Move, storage, other.storage);
+
+            return *this;
+        }
+
+        ~SystemCallback()
+        {
+            reset();
+        }
+
+        inline void operator()(Ecs *ecs, SystemTicks ticks)
+        {
+            invoke_fn(storage, ecs, ticks);
+        }
+
+        inline explicit operator bool() const
+        {
+            return invoke_fn != nullptr;
+        }
+
+    private:
+        enum class Operation
+        {
+            Copy,
+            Move,
+            Destroy
+        };
+
+        void reset()
+        {
+            if (manage_fn != nullptr)
+                manage_fn(Operation::Destroy, storage, nullptr);
+
+            invoke_fn = nullptr;
+            manage_fn = nullptr;
+        }
+
+        void (*invoke_fn)(void *, Ecs *, SystemTicks) = nullptr;
+        void (*manage_fn)(Operation, void *dst, void *src) = nullptr;
+        alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+    };
+
     struct SystemWrapper
     {
-        SystemWrapper() : callback({}), c_read(0), c_write(0), r_read(0), r_write(0) {};
+        SystemWrapper() : c_read(0), c_write(0), r_read(0), r_write(0) {};
 
-        SystemWrapper(std::function<void(Ecs *)> callback, bit::Bitset c_read, bit::Bitset c_write, bit::Bitset r_read, bit::Bitset r_write)
-            : callback(callback),
+        SystemWrapper(SystemCallback callback, bit::Bitset c_read, bit::Bitset c_write, bit::Bitset r_read, bit::Bitset r_write)
+            : callback(std::move(callback)),
               c_read(c_read),
               c_write(c_write),
               r_read(r_read),
@@ -229,7 +611,8 @@ namespace vecs
         {
         }
 
-        std::function<void(Ecs *)> callback;
+        SystemCallback callback;
+        uint32_t last_run = 0; // Tick of the previous run, change filters compare against it
 
         bit::Bitset c_read;
         bit::Bitset c_write;
@@ -238,87 +621,317 @@ namespace vecs
         bit::Bitset r_write;
     };
 
+    struct Group;
+
     struct SparseSetBase
     {
         virtual ~SparseSetBase() = default;
 
         void (*remove)(SparseSetBase *, Entity); // Gets created when creating a new sparseset -> caches Type at comp time for type erased removal
+        void (*destroy)(SparseSetBase *, std::pmr::memory_resource *) = nullptr; // Destructs and frees the set, same caching as remove
+
+        Group *group = nullptr; // Owning group that decides the dense order, if any
+
+        uint64_t version = 0; // Bumped whenever an entity joins or leaves or the dense order changes, queries cache on it
+
+        DirtySet dirty; // Entities whose component got added, written or removed since the last delta, while tracking
     };
 
-    template <typename T>
-    struct DenseEntry
+    /// @brief Owning group: the first size entries of every owned set belong to the same entities in the same order.
+    /// An entity is inside that prefix exactly when it has every owned component
+    struct Group
     {
+        ComponentMask mask;                            // Owned component types
+        uint32_t size = 0;                             // Entities that have every owned component
+        const StorageVector<Entity> *entities = nullptr; // Dense entities of one owned set, the group is its prefix
 
-        T component;
-        Entity entity;
+        void (*enter)(Ecs *, Group &, Entity) = nullptr; // Moves e to the end of the prefix in every owned set, no-op if e is already inside
+        void (*leave)(Ecs *, Group &, Entity) = nullptr; // Moves e just behind the prefix, e must be inside
+        void (*permute)(Ecs *, Group &, const uint32_t *order) = nullptr; // Reorders the prefix of every owned set, see SparseSet::permute
     };
 
+    /// @brief Components and their owners live in parallel arrays, so loops over components only stream component data
     template <typename T>
     struct SparseSet : SparseSetBase
     {
+        /// @param resource Backs every array of the set, nullptr for operator new
+        explicit SparseSet(std::pmr::memory_resource *resource = nullptr) : components(resource), entities(resource), added_ticks(resource), changed_ticks(resource), sparse(resource) {}
 
-        std::vector<DenseEntry<T>> dense;
-        std::vector<uint32_t> sparse;
-    };
+        StorageVector<T> components;          // Packed, starts on a cache line so kernels over it can vectorize
+        StorageVector<Entity> entities;       // entities[i] owns components[i]
+        StorageVector<uint32_t> added_ticks;   // Tick at which components[i] got added
+        StorageVector<uint32_t> changed_ticks; // Tick of the last write to components[i]
+        SparseArray sparse;                   // Entity index -> dense index
 
-    using removeSparseSet = void (*)(SparseSetBase *, Entity);
+        // Progress of an incremental reorder by entity index, see Ecs::sortByEntityIncremental
+        uint32_t sort_next_index = 0; // Next entity index to look at
+        uint32_t sort_position = 0;   // Dense entries below this are in entity order
+        bool sort_moved = false;      // The current pass moved something
 
-    template <typename T>
-    removeSparseSet makeRemoveForSparseSet()
-    {
-        return [](SparseSetBase *base, Entity e)
+        inline size_t size() const
         {
-            SparseSet<T> *set = static_cast<SparseSet<T> *>(base);
+            return entities.size();
+        }
 
-            uint32_t component_index = set->sparse[e];
+        void reserve(size_t count)
+        {
+            components.reserve(count);
+            entities.reserve(count);
+            added_ticks.reserve(count);
+            changed_ticks.reserve(count);
+        }
 
-            if (component_index == NO_ENTITY)
-                return;
+        inline void push(Entity e, T &&component, uint32_t tick)
+        {
+            sparse.set(entityIndex(e), static_cast<uint32_t>(entities.size()));
+            version++;
 
-            Entity last_entity = set->dense.back().entity;
+            components.push_back(std::move(component));
+            entities.push_back(e);
+            added_ticks.push_back(tick);
+            changed_ticks.push_back(tick);
 
-            set->dense[component_index] = set->dense.back();
+            if (dirty.isTracking())
+            {
+                dirty.reserve(entityIndex(e) + 1);
+                dirty.mark(entityIndex(e));
+            }
+        }
 
-            set->sparse[last_entity] = component_index;
+        /// @brief Stamps a write, safe from parallel systems as long as each thread writes its own entries
+        inline void markChanged(uint32_t dense_index, uint32_t tick)
+        {
+            changed_ticks[dense_index] = tick;
 
-            set->dense.pop_back();
+            if (dirty.isTracking())
+                dirty.mark(entityIndex(entities[dense_index]));
+        }
 
-            set->sparse[e] = NO_ENTITY;
-        };
-    }
+        /// @brief Exchanges two dense entries and fixes up the sparse side
+        inline void swapDense(uint32_t a, uint32_t b)
+        {
+            if (a == b)
+                return;
 
-    struct ResourceBase
-    {
-        virtual ~ResourceBase() = default;
-    };
+            std::swap(components[a], components[b]);
+            std::swap(entities[a], entities[b]);
+            std::swap(added_ticks[a], added_ticks[b]);
+            std::swap(changed_ticks[a], changed_ticks[b]);
 
-    template <typename T>
-    struct ResourceData : ResourceBase
-    {
-        T data;
-    };
+            sparse.set(entityIndex(entities[a]), a);
+            sparse.set(entityIndex(entities[b]), b);
 
-    class Ecs
-    {
+            version++;
+        }
+
+        /// @brief Entry i in [begin, end) becomes the old entry order[i - begin], order must be a permutation of that range
+        void permute(const uint32_t *order, uint32_t begin, uint32_t end)
+        {
+            std::vector<T> moved_components;
+            moved_components.reserve(end - begin);
+
+            std::vector<Entity> moved_entities(end - begin);
+            std::vector<uint32_t> moved_added(end - begin);
+            std::vector<uint32_t> moved_changed(end - begin);
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                uint32_t from = order[i - begin];
+
+                moved_components.push_back(std::move(components[from]));
+                moved_entities[i - begin] = entities[from];
+                moved_added[i - begin] = added_ticks[from];
+                moved_changed[i - begin] = changed_ticks[from];
+            }
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                components[i] = std::move(moved_components[i - begin]);
+                entities[i] = moved_entities[i - begin];
+                added_ticks[i] = moved_added[i - begin];
+                changed_ticks[i] = moved_changed[i - begin];
+
+                sparse.set(entityIndex(entities[i]), i);
+            }
+
+            version++;
+        }
+    };
+
+    using removeSparseSet = void (*)(SparseSetBase *, Entity);
+
+    template <typename T>
+    removeSparseSet makeRemoveForSparseSet()
+    {
+        return [](SparseSetBase *base, Entity e)
+        {
+            SparseSet<T> *set = static_cast<SparseSet<T> *>(base);
+
+            uint32_t index = entityIndex(e);
+
+            uint32_t component_index = set->sparse.get(index);
+
+            if (component_index == NO_ENTITY)
+                return;
+
+            uint32_t last_index = static_cast<uint32_t>(set->size() - 1);
+
+            if (component_index != last_index)
+            {
+                Entity last_entity = set->entities[last_index];
+
+                set->components[component_index] = std::move(set->components[last_index]);
+                set->entities[component_index] = last_entity;
+                set->added_ticks[component_index] = set->added_ticks[last_index];
+                set->changed_ticks[component_index] = set->changed_ticks[last_index];
+
+                set->sparse.set(entityIndex(last_entity), component_index);
+            }
+
+            set->components.pop_back();
+            set->entities.pop_back();
+            set->added_ticks.pop_back();
+            set->changed_ticks.pop_back();
+
+            set->sparse.reset(index);
+            set->version++;
+
+            if (set->dirty.isTracking())
+                set->dirty.mark(index);
+        };
+    }
+
+    struct CommandQueueBase;
+
+    using applyCommandQueues = void (*)(Ecs *, CommandQueueBase *const *, size_t);
+
+    struct CommandQueueBase
+    {
+        virtual ~CommandQueueBase() = default;
+
+        applyCommandQueues apply; // Applies the queues of one component type from all buffers in one pass
+        bool used = false;
+    };
+
+    template <typename T>
+    struct CommandQueue : CommandQueueBase
+    {
+        std::vector<Entity> add_entities;
+        std::vector<T> add_components;
+
+        std::vector<Entity> remove_entities;
+
+        void clear()
+        {
+            add_entities.clear();
+            add_components.clear();
+            remove_entities.clear();
+            used = false;
+        }
+    };
+
+    /// @brief Records structural changes from inside systems. Each thread gets its own buffer from SystemView::commands(),
+    /// the world applies them at the end of runSchedule / runScheduleParallel or on Ecs::flushCommands()
+    class CommandBuffer
+    {
     public:
-        Ecs() : pool(thread_pool::ThreadPool()) {
+        CommandBuffer(Ecs *ecs) : ecs(ecs) {}
 
-                };
+        CommandBuffer(const CommandBuffer &) = delete;
+        CommandBuffer &operator=(const CommandBuffer &) = delete;
+
+        /// @brief The id is reserved right away and can be used in further commands, components get attached on flush
+        Entity createEntity();
+
+        template <typename T>
+        void addComponent(Entity e, T component);
+
+        template <typename T>
+        void removeComponent(Entity e);
+
+        void removeEntity(Entity e)
+        {
+            removed_entities.push_back(e);
+        }
+
+    private:
+        friend class Ecs;
+
+        template <typename T>
+        CommandQueue<T> &getQueue();
+
+        Ecs *ecs;
+
+        std::vector<std::unique_ptr<CommandQueueBase>> queues; // Indexed by component type id
+        std::vector<uint32_t> used_types;
+        std::vector<Entity> removed_entities;
+
+        static constexpr uint32_t ENTITY_BLOCK_SIZE = 64;
+
+        // Ids this thread reserved in one go, createEntity hands them out without touching shared state
+        Entity reserved_block[ENTITY_BLOCK_SIZE];
+        uint32_t reserved_next = 0;
+        uint32_t reserved_end = 0;
+    };
+
+    struct ResourceBase
+    {
+        virtual ~ResourceBase() = default;
+
+        void (*destroy)(ResourceBase *, std::pmr::memory_resource *) = nullptr;
+    };
+
+    template <typename T>
+    struct ResourceData : ResourceBase
+    {
+        T data;
+    };
+
+    /// @brief What a view holds per term for resources, nullptr_t for every other term
+    template <typename T>
+    using resource_ptr_t = std::conditional_t<isResource<T>::value, ResourceData<typename unwrapResource<T>::type> *, std::nullptr_t>;
+
+    class Ecs
+    {
+    public:
+        /// @param resource Backs component storage, sparse pages, archetype chunks and resources, e.g. an arena or pool from
+        /// std::pmr or a HugePageResource. Must outlive the world. With a monotonic arena and trivially destructible components
+        /// teardown only walks the component types, the arena's release() then frees everything at once. nullptr uses operator new
+        /// @param shared_pool Runs parallel work on this pool instead of one owned by the world, so many worlds can share
+        /// one set of threads (see runWorlds). Must outlive the world
+        Ecs(StorageMode storage_mode = StorageMode::SparseSet, std::pmr::memory_resource *resource = nullptr, thread_pool::ThreadPool *shared_pool = nullptr)
+            : owned_pool(shared_pool == nullptr ? std::make_unique<thread_pool::ThreadPool>() : nullptr), pool(shared_pool != nullptr ? *shared_pool : *owned_pool),
+              storage_mode(storage_mode), storage_resource(resource)
+        {
+            // One buffer per worker, the last one is for threads outside the pool
+            for (size_t i = 0; i < pool.threadCount() + 1; i++)
+            {
+                command_buffers.push_back(std::make_unique<CommandBuffer>(this));
+                chunk_scratch.push_back(std::make_unique<ChunkScratch>());
+            }
+        };
 
         ~Ecs()
         {
 
             for (auto &set : sets)
             {
-                delete set;
+                if (set != nullptr)
+                    set->destroy(set, storage_resource);
             }
 
             for (auto &resource : resources)
             {
-                delete resource;
+                if (resource != nullptr)
+                    resource->destroy(resource, storage_resource);
             }
         }
 
+        inline StorageMode storageMode() const
+        {
+            return storage_mode;
+        }
+
         struct SystemViewBase
         {
             virtual ~SystemViewBase() = default;
@@ -332,12 +945,24 @@ namespace vecs
             friend class Ecs;
 
         public:
-            SystemView(Ecs *ecs) : ecs(ecs)
+            SystemView(Ecs *ecs, SystemTicks ticks) : ecs(ecs), sets(ecs->resolveSparseSet<Ts>()...), resource_data(ecs->resolveResource<Ts>()...), query_mask(makeQueryMask<Ts...>()), exclude_mask(makeExcludeMask<Ts...>()), ticks(ticks)
 
             {
-                static_assert(((is_read_or_write<Ts>::value || isResource<Ts>::value) && ...), "All members must be in Wrappers");
+                static_assert((is_query_term<Ts>::value && ...), "All members must be in Wrappers");
             };
 
+            /// @brief Ticks of the current run, changes newer than last_run pass Changed<T>
+            inline SystemTicks systemTicks() const
+            {
+                return ticks;
+            }
+
+            /// @brief Command buffer of the calling thread, use it for structural changes inside systems
+            inline CommandBuffer &commands()
+            {
+                return ecs->getCommandBuffer();
+            }
+
             template <typename T>
             auto &getComponent(Entity e)
             {
@@ -346,44 +971,129 @@ namespace vecs
 
                 static_assert(is_read_or_write<T>::value, "Must be a component in Read / Write Wrapper for Multithreading");
 
-                static SparseSet<component_t<T>> &sparse_set = ecs->getOrCreateSparseSet<component_t<T>>();
+                if (ecs->storage_mode == StorageMode::Archetype)
+                {
+                    component_t<T> *component = ecs->getArchetypeComponent<component_t<T>>(e, is_write<T>::value ? &ticks.this_run : nullptr);
+                    assert(component != nullptr);
+
+                    if constexpr (is_read<T>::value)
+                        return static_cast<const component_t<T> &>(*component);
+                    else
+                        return static_cast<component_t<T> &>(*component);
+                }
+
+                SparseSet<component_t<T>> &sparse_set = *setOf<T>();
+
+                uint32_t dense_index = sparse_set.sparse.get(entityIndex(e));
+                assert(dense_index != NO_ENTITY && "Entity does not have this component");
 
                 if constexpr (is_read<T>::value)
                 {
 
-                    return static_cast<const component_t<T> &>(sparse_set.dense[sparse_set.sparse.at(e)].component);
+                    return static_cast<const component_t<T> &>(sparse_set.components[dense_index]);
                 }
                 else
                 {
-                    return static_cast<component_t<T> &>(sparse_set.dense[sparse_set.sparse.at(e)].component);
+                    sparse_set.markChanged(dense_index, ticks.this_run);
+
+                    return static_cast<component_t<T> &>(sparse_set.components[dense_index]);
                 }
             }
 
         private:
             Ecs *ecs;
 
+            // Resolved once per view, so every world reads its own storage
+            std::tuple<sparse_set_ptr_t<Ts>...> sets;
+
+            // Resources never move once inserted, so they get looked up once per view instead of once per entity
+            std::tuple<resource_ptr_t<Ts>...> resource_data;
+
+            ComponentMask query_mask;   // Components every match has
+            ComponentMask exclude_mask; // Components no match has
+
+            SystemTicks ticks;
+
+            // Set when an owning group drives the iteration
+            bool lockstep[sizeof...(Ts) + 1] = {}; // Term set is owned by the group, its dense index is the driving index
+            bool group_exact = false;              // Every entity of the group matches the query
+
+            /// @brief Set of term T, looked up by term position since several terms can share one set (Read<T> + Changed<T>)
+            template <typename T>
+            inline SparseSet<component_t<T>> *setOf() const
+            {
+                return std::get<termIndex<T>()>(sets);
+            }
+
+            /// @brief Entities term T could drive the iteration over, SIZE_MAX if it has no set of its own to walk
+            template <typename T>
+            inline size_t drivingSize() const
+            {
+                if constexpr (is_component_term<T>::value)
+                    return setOf<T>()->size();
+                else
+                    return SIZE_MAX;
+            }
+
             template <typename T>
-            inline decltype(auto) getSystemArgument(Entity e)
+            static constexpr size_t termIndex()
             {
-                static_assert(is_read_or_write<T>::value || isResource<T>::value, "Must be a resource or component");
+                constexpr bool matches[] = {std::is_same_v<T, Ts>..., false};
 
-                if constexpr (is_read_or_write<T>::value)
+                for (size_t i = 0; i < sizeof...(Ts); i++)
+                    if (matches[i])
+                        return i;
+
+                return sizeof...(Ts);
+            }
+
+            /// @brief dense_index is the position of e in the driving set smallest_T, if any
+            template <typename T, typename smallest_T = void>
+            inline decltype(auto) getSystemArgument(Entity e, uint32_t dense_index = 0)
+            {
+                static_assert(is_query_term<T>::value, "Must be a resource or component");
+
+                if constexpr (is_filter<T>::value)
+                {
+                    return FilterTerm{};
+                }
+                else if constexpr (is_optional<T>::value)
+                {
+                    SparseSet<component_t<T>> *sparse_set = setOf<T>();
+
+                    uint32_t index = sparse_set->sparse.get(entityIndex(e));
+                    component_t<T> *component = index == NO_ENTITY ? nullptr : &sparse_set->components[index];
+
+                    if constexpr (writes_component<T>::value)
+                    {
+                        if (component != nullptr)
+                            sparse_set->markChanged(index, ticks.this_run);
+
+                        return component;
+                    }
+                    else
+                    {
+                        return static_cast<const component_t<T> *>(component);
+                    }
+                }
+                else if constexpr (is_read_or_write<T>::value)
                 {
                     // Is Component
 
-                    // Static so each Component SparseSet for each SystemView is only loaded once, then cached
-                    static SparseSet<component_t<T>> &sparse_set = ecs->getOrCreateSparseSet<component_t<T>>();
-                    static std::vector<DenseEntry<component_t<T>>> *dense = &sparse_set.dense;
-                    static std::vector<uint32_t> *sparse = &sparse_set.sparse;
+                    SparseSet<component_t<T>> *sparse_set = setOf<T>();
+
+                    uint32_t index = denseIndexOf<T, smallest_T>(sparse_set, e, dense_index);
 
                     if constexpr (is_read<T>::value)
                     {
                         // Assumes check for Entity happened before
-                        return static_cast<const component_t<T> &>((*dense)[(*sparse)[e]].component);
+                        return static_cast<const component_t<T> &>(sparse_set->components[index]);
                     }
                     else
                     {
-                        return static_cast<component_t<T> &>((*dense)[(*sparse)[e]].component);
+                        sparse_set->markChanged(index, ticks.this_run);
+
+                        return static_cast<component_t<T> &>(sparse_set->components[index]);
                     }
                 }
                 else
@@ -391,12 +1101,7 @@ namespace vecs
 
                     using Inner = typename unwrapResource<T>::type;
 
-                    static uint32_t resource_id = ecs->getResourceId<Inner>();
-
-                    if (resource_id >= ecs->resources.size())
-                        ecs->resources.resize(resource_id + 1, nullptr);
-
-                    ResourceData<Inner> *data = static_cast<ResourceData<Inner> *>(ecs->resources[resource_id]);
+                    ResourceData<Inner> *data = std::get<termIndex<T>()>(resource_data);
 
                     if(data == nullptr)
                     {
@@ -416,24 +1121,71 @@ namespace vecs
                 }
             }
 
+            /// @brief One signature test instead of one sparse lookup per component, also covers With<T> / Without<T>
+            inline bool hasAllComponents(Entity e) const
+            {
+
+                static_assert((is_query_term<Ts>::value && ...), "Must be a resource or component");
+
+                if constexpr ((size_t(is_component_term<Ts>::value) + ... + 0) <= 1 && !(is_without<Ts>::value || ...))
+                {
+                    return true; // Only the driving set itself
+                }
+                else
+                {
+                    const ComponentMask &signature = ecs->entity_signatures[entityIndex(e)];
+
+                    return signature.containsAll(query_mask) && !signature.intersects(exclude_mask);
+                }
+            }
+
+            /// @brief The driving set is walked in dense order, as are the sets a driving group owns. Every other set needs the sparse lookup
+            template <typename T, typename smallest_T>
+            inline uint32_t denseIndexOf(const SparseSet<component_t<T>> *sparse_set, Entity e, uint32_t dense_index) const
+            {
+                if constexpr (std::is_same_v<T, smallest_T>)
+                    return dense_index;
+                else if constexpr (std::is_same_v<smallest_T, GroupDriven>)
+                    return lockstep[termIndex<T>()] ? dense_index : sparse_set->sparse[entityIndex(e)];
+                else
+                    return sparse_set->sparse[entityIndex(e)];
+            }
+
+            /// @brief Full match test for the entity at dense_index of the driving set
             template <typename smallest_T>
-            inline bool hasAllComponents(Entity e)
+            inline bool matches(Entity e, uint32_t dense_index) const
             {
+                if constexpr (std::is_same_v<smallest_T, GroupDriven>)
+                {
+                    if (!group_exact && !hasAllComponents(e))
+                        return false;
+                }
+                else if (!hasAllComponents(e))
+                {
+                    return false;
+                }
 
-                static_assert(((is_read_or_write<Ts>::value || isResource<Ts>::value) && ...), "Must be a resource or component");
+                return passesFilters<smallest_T>(e, dense_index);
+            }
 
-                return (... && hasComponent<Ts, smallest_T>(e));
+            /// @brief Added<T> / Changed<T> terms, only reads ticks. e must have all components
+            template <typename smallest_T>
+            inline bool passesFilters(Entity e, uint32_t dense_index) const
+            {
+                return (passesFilter<Ts, smallest_T>(e, dense_index) && ...);
             }
 
             template <typename T, typename smallest_T>
-            inline bool hasComponent(Entity e)
+            inline bool passesFilter(Entity e, uint32_t dense_index) const
             {
-                if constexpr (is_read_or_write<T>::value && !std::is_same_v<component_t<T>, component_t<smallest_T>>)
+                if constexpr (is_tick_filter<T>::value)
                 {
-                    static SparseSet<component_t<T>> &sparse_set = ecs->getOrCreateSparseSet<component_t<T>>();
-                    static std::vector<uint32_t> *sparse = &sparse_set.sparse;
+                    const SparseSet<component_t<T>> *sparse_set = setOf<T>();
 
-                    return (e < (*sparse).size() && (*sparse)[e] != NO_ENTITY);
+                    uint32_t index = denseIndexOf<T, smallest_T>(sparse_set, e, dense_index);
+                    uint32_t tick = is_added<T>::value ? sparse_set->added_ticks[index] : sparse_set->changed_ticks[index];
+
+                    return isNewerTick(tick, ticks.last_run);
                 }
                 else
                 {
@@ -460,449 +1212,3312 @@ namespace vecs
             return view.template getComponent<Wrapper>(e);
         }
 
-        template <typename T>
-        void addComponent(Entity e, T component)
+        /// @brief Query kept across calls. Its sets and resources get resolved once, not on every call or per entity.
+        /// With cache_matches it also keeps the entities that have the query's components (With / Without included), plus
+        /// their dense index in every set. That list is only rebuilt after one of the query's own sets gained or lost
+        /// entities or got reordered. Added<T> / Changed<T> still get checked on every call. Create it with Ecs::query,
+        /// it must not outlive the world
+        template <typename... Ts>
+        class Query
         {
+        public:
+            Query(Ecs *ecs, bool cache_matches) : ecs(ecs), view(ecs, SystemTicks{}), cache_matches(cache_matches)
+            {
+                if (ecs->storage_mode == StorageMode::SparseSet)
+                    watched = {ecs->watchedSet<Ts>()...};
+            }
 
-            if (hasComponents<T>(e))
-                return;
+            /// @brief Same as Ecs::forEach, Added<T> / Changed<T> compare against the world's last clearTrackers call
+            template <typename Func>
+            void forEach(Func &&func)
+            {
+                beginCall();
 
-            static_assert(!is_read_or_write<T>());
+                if (ecs->storage_mode == StorageMode::Archetype)
+                {
+                    ecs->runForEach<Ts...>(func, view.ticks);
+                    return;
+                }
 
-            SparseSet<T> &set = getOrCreateSparseSet<T>();
+                if (!cache_matches)
+                {
+                    ecs->visitDrivingSet(view, [&](auto tag, SystemView<Ts...> &driving_view, const Entity *driving, size_t count)
+                                         {
+                                             using smallest_T = typename decltype(tag)::type;
 
-            set.dense.push_back({component, e});
+                                             ecs->iterateSparseSet<smallest_T, Ts...>(driving_view, driving, 0, count, func); });
+                    return;
+                }
 
-            uint32_t dense_index = set.dense.size() - 1;
+                refreshMatches();
+                iterateMatches(view, 0, matched.size(), func);
+            }
 
-            if (e >= set.sparse.size())
+            /// @brief Same as Ecs::parallelForEach
+            template <typename Func>
+            void parallelForEach(Func &&func, size_t chunk_size = 0)
             {
-                set.sparse.resize(e + 1, NO_ENTITY);
-            }
+                static_assert(!(isMutableResource<Ts>::value || ...), "ResMut<T> is shared by all entities and can not be split across threads");
 
-            set.sparse[e] = dense_index;
+                beginCall();
 
-            uint32_t comp_index = getTypeId<T>();
+                if (ecs->storage_mode == StorageMode::Archetype || !cache_matches)
+                {
+                    ecs->runParallelForEach<Ts...>(func, chunk_size, view.ticks);
+                    return;
+                }
 
-            if (e >= entity_what_components.size())
-            {
-                entity_what_components.resize(e + 1, {});
+                refreshMatches();
+
+                ecs->parallelRange(matched.size(), chunk_size, [&](size_t begin, size_t end)
+                                   {
+                                       SystemView<Ts...> chunk_view = view;
+                                       iterateMatches(chunk_view, begin, end, func); });
             }
 
-            entity_what_components[e].insert(comp_index);
-        }
+            /// @brief Entities that have every component of the query, in iteration order. Needs cache_matches, only valid until
+            /// the next structural change
+            Span<const Entity> entities()
+            {
+                assert(cache_matches && ecs->storage_mode == StorageMode::SparseSet);
 
-        template <typename T>
-        void removeComponent(Entity e)
-        {
+                refreshMatches();
 
-            SparseSet<T> *set = getOrCreateSparseSet<T>();
+                return Span<const Entity>(matched.data(), matched.size());
+            }
 
-            if (set == nullptr)
-                return;
+            /// @brief Whether e has every component of the query, ignoring Added<T> / Changed<T>
+            bool contains(Entity e) const
+            {
+                if (!ecs->entities.isAlive(e))
+                    return false;
 
-            uint32_t comp_index = getTypeId<T>();
+                if (ecs->storage_mode == StorageMode::Archetype)
+                    return (archetypeHasTerm<Ts>(e) && ...);
 
-            if (e >= entity_what_components.size())
-                return; // Entity has not components yet
+                uint32_t index = entityIndex(e);
 
-            if (entity_what_components[e].count(comp_index) == 0)
-                return; // Does not have component
+                if (index >= ecs->entity_signatures.size())
+                    return view.query_mask.none();
 
-            entity_what_components[e].erase(comp_index);
+                const ComponentMask &signature = ecs->entity_signatures[index];
 
-            set->remove(set, e);
-        }
+                return signature.containsAll(view.query_mask) && !signature.intersects(view.exclude_mask);
+            }
 
-        template <typename... Ts, typename Func>
-        void forEach(Func &&func)
-        {
+            /// @brief Component of term T of any entity through the resolved set, for lookups from inside other loops.
+            /// Write<T> counts as a write for Changed<T>
+            /// @return nullptr if e does not have it
+            template <typename T>
+            auto get(Entity e)
+            {
+                static_assert((std::is_same_v<T, Ts> || ...), "T is not a term of this query");
+                static_assert(is_read_or_write<T>::value, "Must be a component in Read / Write Wrapper");
 
-            static_assert(((is_read_or_write<Ts>::value || isConstResource<Ts>::value || isMutableResource<Ts>::value) && ...),
-                          "All components/resources must be wrapped in Read<T> ,Write<T>, Res<T> or ResMut<T>!");
+                using Component = component_t<T>;
+                using Result = std::conditional_t<is_read<T>::value, const Component *, Component *>;
 
-            uint32_t dense_size_counter = 0;
+                uint32_t tick = ecs->writeTick();
 
-            size_t dense_sizes[] = {(is_read_or_write<Ts>::value ? getOrCreateSparseSet<component_t<Ts>>().dense.size() : SIZE_MAX)...};
+                if (ecs->storage_mode == StorageMode::Archetype)
+                    return static_cast<Result>(ecs->getArchetypeComponent<Component>(e, is_write<T>::value ? &tick : nullptr));
 
-            size_t smallest_index = 0;
-            size_t smallest_size = dense_sizes[0];
+                if (!ecs->entities.isAlive(e))
+                    return static_cast<Result>(nullptr);
 
-            auto data_tuple = std::tuple<Ts...>();
+                SparseSet<Component> *set = view.template setOf<T>();
+                uint32_t dense_index = set->sparse.get(entityIndex(e));
 
-            for (size_t i = 0; i < sizeof...(Ts); i++)
-            {
-                if (dense_sizes[i] < smallest_size)
-                {
-                    smallest_index = i;
-                    smallest_size = dense_sizes[i];
-                }
-            }
+                if (dense_index == NO_ENTITY)
+                    return static_cast<Result>(nullptr);
 
-            size_t count = 0;
+                if constexpr (is_write<T>::value)
+                    set->markChanged(dense_index, tick);
 
-            (
-                [&]()
-                {
-                    if constexpr (is_read_or_write<Ts>::value)
-                    {
-                        if (count++ == smallest_index)
-                        {
-                            iterateSparseSet<Ts, Ts...>(
-                                &getOrCreateSparseSet<component_t<Ts>>(), smallest_index, func);
-                        }
-                    }
-                }(),
-                ...);
-        }
+                return static_cast<Result>(&set->components[dense_index]);
+            }
 
-        Entity createEntity()
-        {
-            static Entity e = 0;
+        private:
+            static constexpr size_t TERMS = sizeof...(Ts);
 
-            return e++;
-        }
+            /// @brief New ticks like every Ecs::forEach call, and resources inserted since the last call
+            void beginCall()
+            {
+                view.ticks = ecs->beginRun(ecs->tracker_tick);
+                view.resource_data = std::make_tuple(ecs->resolveResource<Ts>()...);
+            }
 
-        template <typename T>
-        void insertResource(T data)
-        {
-            uint32_t id = getResourceId<T>();
+            bool setsChanged() const
+            {
+                for (size_t term = 0; term < TERMS; term++)
+                    if (watched[term] != nullptr && watched[term]->version != seen_versions[term])
+                        return true;
 
-            if (id >= resources.size())
+                return false;
+            }
+
+            void refreshMatches()
             {
-                resources.resize(id + 1, nullptr);
-                resources[id] = new ResourceData<T>();
+                if (matches_valid && !setsChanged())
+                    return;
+
+                matched.clear();
+                dense_indices.clear();
+
+                ecs->visitDrivingSet(view, [&](auto tag, SystemView<Ts...> &driving_view, const Entity *driving, size_t count)
+                                     {
+                                         using smallest_T = typename decltype(tag)::type;
+
+                                         for (size_t i = 0; i < count; i++)
+                                         {
+                                             Entity e = driving[i];
+
+                                             if constexpr (std::is_same_v<smallest_T, GroupDriven>)
+                                             {
+                                                 if (!driving_view.group_exact && !driving_view.hasAllComponents(e))
+                                                     continue;
+                                             }
+                                             else if (!driving_view.hasAllComponents(e))
+                                             {
+                                                 continue;
+                                             }
+
+                                             matched.push_back(e);
+                                             (dense_indices.push_back(termDenseIndex<Ts>(e)), ...);
+                                         } });
+
+                for (size_t term = 0; term < TERMS; term++)
+                    if (watched[term] != nullptr)
+                        seen_versions[term] = watched[term]->version;
+
+                matches_valid = true;
             }
 
-            ResourceData<T> &ref = *static_cast<ResourceData<T> *>(resources[id]);
+            /// @return NO_ENTITY for terms without a set and Optional<T> terms e lacks
+            template <typename T>
+            inline uint32_t termDenseIndex(Entity e) const
+            {
+                if constexpr (needs_storage<T>::value)
+                    return view.template setOf<T>()->sparse.get(entityIndex(e));
+                else
+                    return NO_ENTITY;
+            }
 
-            ref.data = data;
+            template <typename Func>
+            void iterateMatches(SystemView<Ts...> &run_view, size_t begin, size_t end, Func &func)
+            {
+                for (size_t k = begin; k < end; k++)
+                {
+                    const uint32_t *row = dense_indices.data() + k * TERMS;
+
+                    if (!(passesCachedFilter<Ts>(run_view, row) && ...))
+                        continue;
+
+                    invokeSystem<Ts...>(func, run_view, matched[k], cachedArgument<Ts>(run_view, matched[k], row)...);
+                }
+            }
+
+            template <typename T>
+            inline bool passesCachedFilter(const SystemView<Ts...> &run_view, const uint32_t *row) const
+            {
+                if constexpr (is_tick_filter<T>::value)
+                {
+                    const SparseSet<component_t<T>> *sparse_set = run_view.template setOf<T>();
+
+                    uint32_t index = row[run_view.template termIndex<T>()];
+                    uint32_t tick = is_added<T>::value ? sparse_set->added_ticks[index] : sparse_set->changed_ticks[index];
+
+                    return isNewerTick(tick, run_view.ticks.last_run);
+                }
+                else
+                {
+                    return true;
+                }
+            }
+
+            /// @brief Like SystemView::getSystemArgument, with the dense indices taken from the cached row
+            template <typename T>
+            inline decltype(auto) cachedArgument(SystemView<Ts...> &run_view, Entity e, const uint32_t *row)
+            {
+                if constexpr (is_read_or_write<T>::value || is_optional<T>::value)
+                {
+                    SparseSet<component_t<T>> *sparse_set = run_view.template setOf<T>();
+
+                    uint32_t index = row[run_view.template termIndex<T>()];
+
+                    if constexpr (is_optional<T>::value)
+                    {
+                        component_t<T> *component = index == NO_ENTITY ? nullptr : &sparse_set->components[index];
+
+                        if constexpr (writes_component<T>::value)
+                        {
+                            if (component != nullptr)
+                                sparse_set->markChanged(index, run_view.ticks.this_run);
+
+                            return component;
+                        }
+                        else
+                        {
+                            return static_cast<const component_t<T> *>(component);
+                        }
+                    }
+                    else if constexpr (is_read<T>::value)
+                    {
+                        return static_cast<const component_t<T> &>(sparse_set->components[index]);
+                    }
+                    else
+                    {
+                        sparse_set->markChanged(index, run_view.ticks.this_run);
+
+                        return static_cast<component_t<T> &>(sparse_set->components[index]);
+                    }
+                }
+                else
+                {
+                    // Filters and resources do not depend on where e lives
+                    return run_view.template getSystemArgument<T>(e);
+                }
+            }
+
+            template <typename T>
+            bool archetypeHasTerm(Entity e) const
+            {
+                if constexpr (is_component_term<T>::value)
+                    return ecs->getArchetypeComponent<component_t<T>>(e) != nullptr;
+                else if constexpr (is_without<T>::value)
+                    return ecs->getArchetypeComponent<component_t<T>>(e) == nullptr;
+                else
+                    return true;
+            }
+
+            Ecs *ecs;
+            SystemView<Ts...> view; // Sets and masks resolved once, ticks and resources renewed per call
+
+            bool cache_matches;
+            bool matches_valid = false;
+
+            std::vector<Entity> matched;         // Entities with every component of the query
+            std::vector<uint32_t> dense_indices; // TERMS entries per matched entity, the dense index in each term's set
+
+            std::array<SparseSetBase *, TERMS> watched = {}; // Sets whose changes can change the matches, Without<T> ones too
+            std::array<uint64_t, TERMS> seen_versions = {};  // Their versions the list was built from
+        };
+
+        template <typename T>
+        void addComponent(Entity e, T component)
+        {
+
+            static_assert(!is_read_or_write<T>());
+
+            if (!entities.isAlive(e))
+                return;
+
+            if (storage_mode == StorageMode::Archetype)
+            {
+                addArchetypeComponent<T>(e, std::move(component));
+                return;
+            }
+
+            uint32_t index = entityIndex(e);
+            uint32_t comp_index = getTypeId<T>();
+
+            if (index >= entity_signatures.size())
+            {
+                entity_signatures.resize(index + 1);
+            }
+
+            if (entity_signatures[index].test(comp_index))
+                return;
+
+            SparseSet<T> &set = getOrCreateSparseSet<T>();
+
+            set.push(e, std::move(component), writeTick());
+
+            entity_signatures[index].set(comp_index);
+
+            if (set.group != nullptr && entity_signatures[index].containsAll(set.group->mask))
+                set.group->enter(this, *set.group, e);
+        }
+
+        template <typename T>
+        void removeComponent(Entity e)
+        {
+
+            if (!entities.isAlive(e))
+                return;
+
+            if (storage_mode == StorageMode::Archetype)
+            {
+                removeArchetypeComponent(e, getTypeId<T>());
+                return;
+            }
+
+            SparseSet<T> *set = &getOrCreateSparseSet<T>();
+
+            uint32_t comp_index = getTypeId<T>();
+            uint32_t index = entityIndex(e);
+
+            if (index >= entity_signatures.size())
+                return; // Entity has not components yet
+
+            if (!entity_signatures[index].test(comp_index))
+                return; // Does not have component
+
+            if (set->group != nullptr && entity_signatures[index].containsAll(set->group->mask))
+                set->group->leave(this, *set->group, e);
+
+            entity_signatures[index].reset(comp_index);
+
+            set->remove(set, e);
         }
 
+        /// @brief Calls func(view, e, args...) for every entity that matches Ts. Added<T> / Changed<T> compare against
+        /// the last clearTrackers call, writes through Write<T> count as changes
         template <typename... Ts, typename Func>
-        uint32_t addSystem(Schedule &schedule, Func &&func)
+        void forEach(Func &&func)
         {
 
-            static_assert(((is_read_or_write<Ts>::value || isConstResource<Ts>::value || isMutableResource<Ts>::value) && ...),
-                          "All components must be wrapped in Read<T> or Write<T>!");
+            static_assert((is_query_term<Ts>::value && ...),
+                          "All components/resources must be wrapped in Read<T> ,Write<T>, Res<T>, ResMut<T> or be a filter!");
+
+            runForEach<Ts...>(func, beginRun(tracker_tick));
+        }
+
+        /// @brief Same as forEach, but splits the matching entities into chunks that run on the thread pool.
+        /// Blocks until every chunk is done. Each entity is only visited by one thread, so Read / Write access
+        /// is safe, func itself gets called concurrently and must be thread safe.
+        /// @param chunk_size Entities per job, 0 picks a size from the entity and worker count
+        template <typename... Ts, typename Func>
+        void parallelForEach(Func &&func, size_t chunk_size = 0)
+        {
+            static_assert((is_query_term<Ts>::value && ...),
+                          "All components/resources must be wrapped in Read<T> ,Write<T>, Res<T>, ResMut<T> or be a filter!");
+
+            static_assert(!(isMutableResource<Ts>::value || ...), "ResMut<T> is shared by all entities and can not be split across threads");
+
+            runParallelForEach<Ts...>(func, chunk_size, beginRun(tracker_tick));
+        }
+
+        /// @brief Query over Ts to keep and run many times, see Query. cache_matches pays off when the same query runs
+        /// every frame or gets looked into from other loops while its sets change rarely, e.g. a selective filter
+        template <typename... Ts>
+        Query<Ts...> query(bool cache_matches = false)
+        {
+            static_assert((is_query_term<Ts>::value && ...),
+                          "All components/resources must be wrapped in Read<T> ,Write<T>, Res<T>, ResMut<T> or be a filter!");
+
+            return Query<Ts...>(this, cache_matches);
+        }
+
+        static constexpr size_t CHUNK_SPAN_SIZE = 256;
+
+        /// @brief Like forEach, but func(view, Span<const Entity> entities, args...) gets up to max_span matching entities per call.
+        /// Read<T> terms arrive as Span<const T>, Write<T> terms as Span<T>, resources as references, all spans have the same size.
+        /// Every span starts on a cache line: it points into storage when the components lie contiguous there and the first
+        /// one is 64 byte aligned, otherwise into aligned per thread scratch buffers whose Write<T> data gets moved back after the call
+        template <typename... Ts, typename Func>
+        void forEachChunk(Func &&func, size_t max_span = CHUNK_SPAN_SIZE)
+        {
+            static_assert((is_query_term<Ts>::value && ...),
+                          "All components/resources must be wrapped in Read<T> ,Write<T>, Res<T>, ResMut<T> or be a filter!");
+
+            static_assert(!(is_optional<Ts>::value || ...), "Optional<T> is per entity, use forEach");
+
+            assert(max_span > 0);
+
+            runForEachChunk<Ts...>(func, max_span, beginRun(tracker_tick));
+        }
+
+        /// @brief forEachChunk split across the thread pool, see parallelForEach
+        template <typename... Ts, typename Func>
+        void parallelForEachChunk(Func &&func, size_t max_span = CHUNK_SPAN_SIZE)
+        {
+            static_assert((is_query_term<Ts>::value && ...),
+                          "All components/resources must be wrapped in Read<T> ,Write<T>, Res<T>, ResMut<T> or be a filter!");
 
-            // Unique Lookup Tables for each combination, gets only created once on first call
-            static const auto c_lookup_write_table = [&]()
+            static_assert(!(isMutableResource<Ts>::value || ...), "ResMut<T> is shared by all entities and can not be split across threads");
+
+            static_assert(!(is_optional<Ts>::value || ...), "Optional<T> is per entity, use parallelForEach");
+
+            assert(max_span > 0);
+
+            runParallelForEachChunk<Ts...>(func, max_span, beginRun(tracker_tick));
+        }
+
+        /// @brief Starts a new change detection window for forEach, changes made so far stop passing Added<T> / Changed<T>.
+        /// Systems keep their own window from one run to the next
+        void clearTrackers()
+        {
+            tracker_tick = change_tick.load(std::memory_order_relaxed);
+        }
+
+        Entity createEntity()
+        {
+            return entities.create();
+        }
+
+        /// @brief Makes room for count components of type T, so filling the storage does not reallocate
+        template <typename T>
+        void reserve(size_t count)
+        {
+            if (storage_mode == StorageMode::Archetype)
             {
-                bit::Bitset write(sizeof...(Ts));
+                registerComponentInfo<T>(); // Chunks get allocated on demand
+                return;
+            }
+
+            getOrCreateSparseSet<T>().reserve(count);
+        }
+
+        /// @brief Declares an owning group over Ts: their sparse sets keep the entities that have all of Ts at the front, in the same order.
+        /// Queries that require every T walk that prefix in lockstep, without sparse lookups for the owned terms. A component type can
+        /// be owned by one group only, adding it to a second one aborts. Archetypes already store such entities together, so this is a no-op for them
+        template <typename... Ts>
+        void addGroup()
+        {
+            static_assert(sizeof...(Ts) > 1, "A group needs at least two components");
+            static_assert((!is_query_term<Ts>::value && ...), "Groups take plain component types");
+
+            if (storage_mode == StorageMode::Archetype)
+                return;
+
+            if ((... || (getOrCreateSparseSet<Ts>().group != nullptr)))
+            {
+                std::cerr << "Component is already owned by a group\n";
+                std::abort();
+            }
+
+            auto group = std::make_unique<Group>();
+
+            ((group->mask.set(getTypeId<Ts>())), ...);
+
+            group->entities = &getOrCreateSparseSet<std::tuple_element_t<0, std::tuple<Ts...>>>().entities;
+            group->enter = &enterGroup<Ts...>;
+            group->leave = &leaveGroup<Ts...>;
+            group->permute = &permuteGroup<Ts...>;
+
+            ((getOrCreateSparseSet<Ts>().group = group.get()), ...);
+
+            fillGroup(*group);
+
+            groups.push_back(std::move(group));
+        }
+
+        /// @brief Sorts the dense arrays of T with compare(const T &, const T &). For a grouped T the group prefix and the rest get
+        /// sorted on their own and the other owned sets follow the prefix, so they stay in lockstep.
+        /// Structural like addComponent, must not run while systems run. Archetype storage has no per type order, it is a no-op there
+        template <typename T, typename Compare>
+        void sort(Compare compare)
+        {
+            sortSparseSet<T>([&](const SparseSet<T> &set, uint32_t a, uint32_t b)
+                             { return compare(set.components[a], set.components[b]); });
+        }
+
+        /// @brief Sorts T by entity index, entities created together end up next to each other again
+        template <typename T>
+        void sortByEntity()
+        {
+            sortSparseSet<T>([](const SparseSet<T> &set, uint32_t a, uint32_t b)
+                             { return entityIndex(set.entities[a]) < entityIndex(set.entities[b]); });
+        }
+
+        /// @brief Orders T like U: entities that have both come first, in the dense order of U, the others keep their relative order behind them
+        template <typename T, typename U>
+        void sortLike()
+        {
+            if (storage_mode == StorageMode::Archetype)
+                return;
+
+            const SparseSet<U> &like = getOrCreateSparseSet<U>();
+
+            sortSparseSet<T>([&](const SparseSet<T> &set, uint32_t a, uint32_t b)
+                             {
+                                 uint32_t rank_a = like.sparse.get(entityIndex(set.entities[a]));
+                                 uint32_t rank_b = like.sparse.get(entityIndex(set.entities[b]));
+
+                                 return rank_a != rank_b ? rank_a < rank_b : a < b; });
+        }
+
+        /// @brief Spreads sortByEntity over frames: looks at up to budget entity indices and moves their T entries into place.
+        /// Structural changes in between are fine, what they disorder gets fixed by the next pass.
+        /// Grouped types can't move single rows without breaking lockstep, they get a full sortByEntity in one call
+        /// @return true when a pass finished without moving anything, T is in entity order then
+        template <typename T>
+        bool sortByEntityIncremental(size_t budget)
+        {
+            if (storage_mode == StorageMode::Archetype)
+                return true;
+
+            SparseSet<T> &set = getOrCreateSparseSet<T>();
+
+            if (set.group != nullptr)
+            {
+                sortByEntity<T>();
+                return true;
+            }
+
+            uint32_t index_count = entities.indexCount();
+
+            for (size_t step = 0; step < budget; step++)
+            {
+                if (set.sort_next_index >= index_count || set.sort_position >= set.size())
+                {
+                    bool sorted = !set.sort_moved;
+
+                    set.sort_next_index = 0;
+                    set.sort_position = 0;
+                    set.sort_moved = false;
+
+                    return sorted;
+                }
+
+                uint32_t dense_index = set.sparse.get(set.sort_next_index++);
+
+                if (dense_index == NO_ENTITY)
+                    continue;
+
+                if (dense_index != set.sort_position)
+                {
+                    set.swapDense(dense_index, set.sort_position);
+                    set.sort_moved = true;
+                }
+
+                set.sort_position++;
+            }
+
+            return false;
+        }
+
+        /// @brief Creates one entity per element and moves the components out of the spans, all spans need the same size
+        template <typename... Ts>
+        EntityRange spawnBatch(Span<Ts>... components)
+        {
+            static_assert(sizeof...(Ts) > 0, "Spawn needs at least one component");
+
+            size_t count = std::get<0>(std::forward_as_tuple(components...)).size();
+            assert(((components.size() == count) && ...) && "Component spans differ in size");
+
+            EntityRange range = createEntities(static_cast<uint32_t>(count));
+
+            insertBatchImpl<Ts...>(range, components...);
+
+            return range;
+        }
+
+        /// @brief Adds components[i] to entities[i] for every component span, moves the components out.
+        /// Dead entities and components an entity already has are skipped, like in addComponent
+        template <typename... Ts>
+        void insertBatch(Span<const Entity> entities, Span<Ts>... components)
+        {
+            insertBatchImpl<Ts...>(entities, components...);
+        }
+
+        template <typename... Ts>
+        void insertBatch(EntityRange entities, Span<Ts>... components)
+        {
+            insertBatchImpl<Ts...>(entities, components...);
+        }
+
+        /// @brief count new entities with consecutive ids
+        EntityRange createEntities(uint32_t count)
+        {
+            return entities.createRange(count);
+        }
+
+        /// @brief Thread safe, the entity can be used right away in command buffers and becomes a regular entity on the next flush
+        Entity reserveEntity()
+        {
+            return entities.reserve();
+        }
+
+        /// @brief false for destroyed entities, even if their index got reused
+        inline bool isAlive(Entity e) const
+        {
+            return entities.isAlive(e);
+        }
+
+        /// @brief Command buffer of the calling thread
+        CommandBuffer &getCommandBuffer()
+        {
+            size_t worker = pool.currentWorkerIndex();
+
+            if (worker == thread_pool::ThreadPool::NO_WORKER)
+                return *command_buffers.back();
+
+            return *command_buffers[worker];
+        }
+
+        /// @brief Applies all recorded commands. Per component type the queues of every buffer get applied together,
+        /// additions before removals, entity removals come last. Must not run while systems are running.
+        void flushCommands()
+        {
+            entities.flushReserved();
+
+            // What is left of each buffer's block never got handed out
+            for (auto &buffer : command_buffers)
+            {
+                entities.returnReserved(buffer->reserved_block + buffer->reserved_next, buffer->reserved_end - buffer->reserved_next);
+                buffer->reserved_next = buffer->reserved_end = 0;
+            }
+
+            std::vector<uint32_t> type_ids;
+
+            for (auto &buffer : command_buffers)
+                type_ids.insert(type_ids.end(), buffer->used_types.begin(), buffer->used_types.end());
+
+            std::sort(type_ids.begin(), type_ids.end());
+            type_ids.erase(std::unique(type_ids.begin(), type_ids.end()), type_ids.end());
+
+            std::vector<CommandQueueBase *> batch;
+
+            for (uint32_t type_id : type_ids)
+            {
+                batch.clear();
+
+                for (auto &buffer : command_buffers)
+                {
+                    if (type_id < buffer->queues.size() && buffer->queues[type_id] && buffer->queues[type_id]->used)
+                        batch.push_back(buffer->queues[type_id].get());
+                }
+
+                batch[0]->apply(this, batch.data(), batch.size());
+            }
+
+            for (auto &buffer : command_buffers)
+            {
+                for (Entity e : buffer->removed_entities)
+                    removeEntity(e);
+
+                buffer->removed_entities.clear();
+                buffer->used_types.clear();
+            }
+        }
+
+        template <typename T>
+        void insertResource(T data)
+        {
+            uint32_t id = getResourceId<T>();
+
+            // Ids are process wide, so another world may have handed out higher ones first
+            if (id >= resources.size())
+                resources.resize(id + 1, nullptr);
+
+            if (resources[id] == nullptr)
+            {
+                resources[id] = createInResource<ResourceData<T>>(storage_resource);
+                resources[id]->destroy = [](ResourceBase *base, std::pmr::memory_resource *resource)
+                { destroyInResource(resource, static_cast<ResourceData<T> *>(base)); };
+            }
+
+            ResourceData<T> &ref = *static_cast<ResourceData<T> *>(resources[id]);
+
+            ref.data = data;
+        }
+
+        /// @param parallel Split the entities of this system across the thread pool, see parallelForEach
+        /// @param chunk_size Entities per job for parallel systems, 0 = adaptive
+        template <typename... Ts, typename Func>
+        uint32_t addSystem(Schedule &schedule, Func &&func, bool parallel = false, size_t chunk_size = 0)
+        {
+
+            static_assert((is_query_term<Ts>::value && ...),
+                          "All components must be wrapped in Read<T> or Write<T>!");
+
+            SystemCallback wrapper = [func](Ecs *ecs, SystemTicks ticks)
+            {
+                ecs->runForEach<Ts...>(func, ticks);
+            };
+
+            if constexpr (!(isMutableResource<Ts>::value || ...))
+            {
+                if (parallel)
+                {
+                    wrapper = [func, chunk_size](Ecs *ecs, SystemTicks ticks)
+                    {
+                        ecs->runParallelForEach<Ts...>(func, chunk_size, ticks);
+                    };
+                }
+            }
+            else
+            {
+                assert(!parallel && "Systems with ResMut<T> can not be split across threads");
+            }
+
+            return insertSystem<Ts...>(schedule, std::move(wrapper));
+        }
+
+        /// @brief System that gets its entities as spans, see forEachChunk
+        /// @param parallel Split the spans across the thread pool, see parallelForEachChunk
+        template <typename... Ts, typename Func>
+        uint32_t addChunkSystem(Schedule &schedule, Func &&func, bool parallel = false, size_t max_span = CHUNK_SPAN_SIZE)
+        {
+            static_assert((is_query_term<Ts>::value && ...),
+                          "All components must be wrapped in Read<T> or Write<T>!");
+
+            static_assert(!(is_optional<Ts>::value || ...), "Optional<T> is per entity, use addSystem");
+
+            SystemCallback wrapper = [func, max_span](Ecs *ecs, SystemTicks ticks)
+            {
+                ecs->runForEachChunk<Ts...>(func, max_span, ticks);
+            };
+
+            if constexpr (!(isMutableResource<Ts>::value || ...))
+            {
+                if (parallel)
+                {
+                    wrapper = [func, max_span](Ecs *ecs, SystemTicks ticks)
+                    {
+                        ecs->runParallelForEachChunk<Ts...>(func, max_span, ticks);
+                    };
+                }
+            }
+            else
+            {
+                assert(!parallel && "Systems with ResMut<T> can not be split across threads");
+            }
+
+            return insertSystem<Ts...>(schedule, std::move(wrapper));
+        }
+
+        void removeSystem(Schedule &schedule, uint32_t system_id)
+        {
+            auto &ids = schedule.systems;
+            ids.erase(std::remove(ids.begin(), ids.end(), system_id), ids.end());
+
+            auto &orderings = schedule.orderings;
+            orderings.erase(std::remove_if(orderings.begin(), orderings.end(), [system_id](const std::pair<uint32_t, uint32_t> &ordering)
+                                           { return ordering.first == system_id || ordering.second == system_id; }),
+                            orderings.end());
+
+            schedule.dirty = true;
+        }
+
+        void runSchedule(Schedule &schedule)
+        {
+            compileSchedule(schedule);
+
+            for (uint32_t node : schedule.topological_order)
+            {
+                runSystem(schedule.systems[node]);
+            }
+
+            flushCommands();
+
+#ifdef VECS_PROFILE
+            system_profiler.endFrame(pool);
+#endif
+        }
+
+        /// @brief Runs every system as soon as all systems it depends on are done. Systems on the critical path of the graph get picked first
+        void runScheduleParallel(Schedule &schedule)
+        {
+            compileSchedule(schedule);
+
+            size_t system_count = schedule.systems.size();
+
+            // An empty schedule still ends the frame like runSchedule: commands get flushed and the profiler advances
+            updateSchedulePriorities(schedule);
+
+            for (size_t i = 0; i < system_count; i++)
+                schedule.pending_predecessors[i].store(schedule.predecessor_counts[i], std::memory_order_relaxed);
+
+            thread_pool::TaskGroup group(pool);
+
+            for (uint32_t root : schedule.roots)
+            {
+                group.spawn([this, &schedule, root, &group]()
+                            { runScheduleNode(schedule, root, group); });
+            }
+
+#ifdef VECS_PROFILE
+            uint64_t wait_start = system_profiler.now();
+#endif
+
+            // Main thread works on systems instead of sleeping
+            group.wait();
+
+#ifdef VECS_PROFILE
+            recordProfileEvent(ProfileEventKind::Wait, wait_start, NO_SYSTEM);
+#endif
+
+            flushCommands();
+
+#ifdef VECS_PROFILE
+            system_profiler.endFrame(pool);
+#endif
+        }
+
+        void removeEntity(Entity e)
+        {
+
+            if (!entities.isAlive(e))
+                return; // Already removed
+
+            if (storage_mode == StorageMode::Archetype)
+            {
+                removeArchetypeEntity(e);
+            }
+            else
+            {
+                removeAllComponents(e);
+            }
+
+            entities.destroy(e);
+        };
+
+        /// @brief Makes T part of snapshots. name identifies T across builds, both the saving and the loading world register it.
+        /// T gets stored as raw blocks, so it must be trivially copyable
+        template <typename T>
+        void registerSnapshotComponent(std::string_view name)
+        {
+            static_assert(std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>, "Pass save / load hooks for this component");
+
+            addSnapshotComponent<T>(name, sizeof(T), nullptr, nullptr);
+        }
+
+        /// @brief Same for any T, save(SnapshotWriter &, const T &) writes one component and load(SnapshotReader &) returns it
+        template <typename T, typename Save, typename Load>
+        void registerSnapshotComponent(std::string_view name, Save save, Load load)
+        {
+            addSnapshotComponent<T>(name, 0, std::move(save), std::move(load));
+        }
+
+        /// @brief Makes resource T part of snapshots, see registerSnapshotComponent
+        template <typename T>
+        void registerSnapshotResource(std::string_view name)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Pass save / load hooks for this resource");
+
+            addSnapshotResource<T>(name, [](SnapshotWriter &out, const T &value)
+                                   { out.writeValue(value); }, [](SnapshotReader &in)
+                                   { return in.template readValue<T>(); });
+        }
+
+        template <typename T, typename Save, typename Load>
+        void registerSnapshotResource(std::string_view name, Save save, Load load)
+        {
+            addSnapshotResource<T>(name, std::move(save), std::move(load));
+        }
+
+        /// @brief Appends the world to out: entity ids, then per registered component its entity, tick, component and sparse page arrays
+        /// as aligned blocks, then the registered resources. Signatures are rebuilt on load. Sparse set storage only
+        bool saveSnapshot(SnapshotWriter &out)
+        {
+            if (storage_mode == StorageMode::Archetype)
+                return false;
+
+            entities.flushReserved();
+
+            const std::vector<uint32_t> &generations = entities.generationTable();
+            const std::vector<uint32_t> &free_list = entities.freeList();
+
+            out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+            out.writeValue(SNAPSHOT_VERSION);
+            out.writeValue(change_tick.load(std::memory_order_relaxed));
+            out.writeValue(tracker_tick);
+            out.writeValue(static_cast<uint32_t>(generations.size()));
+            out.writeValue(static_cast<uint32_t>(free_list.size()));
+
+            out.align();
+            out.write(generations.data(), generations.size() * sizeof(uint32_t));
+            out.align();
+            out.write(free_list.data(), free_list.size() * sizeof(uint32_t));
+
+            writeTypeBlocks(out, snapshot_components, &SnapshotType::save);
+            writeTypeBlocks(out, snapshot_resources, &SnapshotType::save);
+
+            return true;
+        }
+
+        bool saveSnapshot(const std::string &path)
+        {
+            SnapshotWriter out;
+            return saveSnapshot(out) && writeFile(path, out);
+        }
+
+        /// @brief Loads a snapshot into this world, which must not have created any entity yet. The arrays get copied in bulk,
+        /// blocks of types this world did not register are skipped
+        /// @return false if the data is malformed or got written with a different layout of a raw component
+        bool loadSnapshot(const void *data, size_t size)
+        {
+            if (storage_mode == StorageMode::Archetype)
+                return false;
+
+            assert(entities.indexCount() == 0 && "Snapshots load into empty worlds");
+
+            SnapshotReader in(data, size);
+
+            char magic[sizeof(SNAPSHOT_MAGIC)];
+            in.read(magic, sizeof(magic));
+
+            if (std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || in.readValue<uint32_t>() != SNAPSHOT_VERSION)
+                return false;
+
+            uint32_t saved_change_tick = in.readValue<uint32_t>();
+            uint32_t saved_tracker_tick = in.readValue<uint32_t>();
+            uint32_t index_count = in.readValue<uint32_t>();
+            uint32_t free_count = in.readValue<uint32_t>();
+
+            in.align();
+            const uint32_t *generations = reinterpret_cast<const uint32_t *>(in.take(size_t(index_count) * sizeof(uint32_t)));
+            in.align();
+            const uint32_t *free_list = reinterpret_cast<const uint32_t *>(in.take(size_t(free_count) * sizeof(uint32_t)));
+
+            if (!in.ok())
+                return false;
+
+            entities.restore(std::vector<uint32_t>(generations, generations + index_count), std::vector<uint32_t>(free_list, free_list + free_count));
+            entity_signatures.assign(index_count, ComponentMask{});
+
+            if (!readTypeBlocks(in, snapshot_components, &SnapshotType::load) || !readTypeBlocks(in, snapshot_resources, &SnapshotType::load))
+                return false;
+
+            change_tick.store(saved_change_tick, std::memory_order_relaxed);
+            tracker_tick = saved_tracker_tick;
+
+            for (auto &group : groups)
+            {
+                group->size = 0;
+                fillGroup(*group);
+            }
+
+            return true;
+        }
+
+        /// @brief Maps the file where the platform allows it and loads straight from the mapping
+        bool loadSnapshot(const std::string &path)
+        {
+            MappedFile file(path);
+            return file.isOpen() && loadSnapshot(file.data(), file.size());
+        }
+
+        /// @brief Starts recording which entities and registered components change, so saveDelta only has to visit those.
+        /// Start it right after the snapshot or delta the receiving world got in sync with
+        void beginDeltaTracking()
+        {
+            entities.flushReserved();
+            entities.setTracking(true);
+
+            for (SnapshotType &type : snapshot_components)
+            {
+                type.storage->dirty.setTracking(true);
+                type.storage->dirty.reserve(entities.indexCount());
+            }
+        }
+
+        void endDeltaTracking()
+        {
+            entities.setTracking(false);
+
+            for (SnapshotType &type : snapshot_components)
+                type.storage->dirty.setTracking(false);
+        }
+
+        /// @brief Appends everything that changed since beginDeltaTracking or the previous saveDelta and starts the next window:
+        /// the generation of every created or destroyed entity index, the changed part of the free list, per registered component
+        /// the added or written values and the removed entities, then all registered resources. Costs O(changes)
+        bool saveDelta(SnapshotWriter &out)
+        {
+            if (storage_mode == StorageMode::Archetype || !entities.touchedIndices().isTracking())
+                return false;
+
+            entities.flushReserved();
+
+            const std::vector<uint32_t> &generations = entities.generationTable();
+            const std::vector<uint32_t> &free_list = entities.freeList();
+
+            std::vector<uint32_t> touched;
+            entities.touchedIndices().forEach([&](uint32_t index)
+                                              { touched.push_back(index); });
+
+            size_t free_keep = entities.unchangedFreeListPrefix();
+
+            out.write(DELTA_MAGIC, sizeof(DELTA_MAGIC));
+            out.writeValue(DELTA_VERSION);
+            out.writeValue(entities.indexCount());
+            out.writeValue(static_cast<uint32_t>(touched.size()));
+            out.writeValue(static_cast<uint32_t>(free_keep));
+            out.writeValue(static_cast<uint32_t>(free_list.size() - free_keep));
+
+            out.align();
+            out.write(touched.data(), touched.size() * sizeof(uint32_t));
+            out.align();
+            for (uint32_t index : touched)
+                out.writeValue(generations[index]);
+            out.align();
+            out.write(free_list.data() + free_keep, (free_list.size() - free_keep) * sizeof(uint32_t));
+
+            writeTypeBlocks(out, snapshot_components, &SnapshotType::save_delta);
+            writeTypeBlocks(out, snapshot_resources, &SnapshotType::save);
+
+            entities.clearTouched();
+
+            for (SnapshotType &type : snapshot_components)
+                type.storage->dirty.clear();
+
+            return true;
+        }
+
+        /// @brief Replays a delta. This world must be in the state the source world had when the delta window started,
+        /// e.g. loaded from the same snapshot and fed every delta since. Applied values count as writes for Changed<T>
+        /// @return false if the data is malformed, the world may then be partially updated
+        bool applyDelta(const void *data, size_t size)
+        {
+            if (storage_mode == StorageMode::Archetype)
+                return false;
+
+            entities.flushReserved();
+
+            SnapshotReader in(data, size);
+
+            char magic[sizeof(DELTA_MAGIC)];
+            in.read(magic, sizeof(magic));
+
+            if (std::memcmp(magic, DELTA_MAGIC, sizeof(magic)) != 0 || in.readValue<uint32_t>() != DELTA_VERSION)
+                return false;
+
+            uint32_t index_count = in.readValue<uint32_t>();
+            uint32_t touched_count = in.readValue<uint32_t>();
+            uint32_t free_keep = in.readValue<uint32_t>();
+            uint32_t free_tail_count = in.readValue<uint32_t>();
+
+            in.align();
+            const unsigned char *touched = in.take(size_t(touched_count) * sizeof(uint32_t));
+            in.align();
+            const unsigned char *touched_generations = in.take(size_t(touched_count) * sizeof(uint32_t));
+            in.align();
+            const unsigned char *free_tail = in.take(size_t(free_tail_count) * sizeof(uint32_t));
+
+            if (!in.ok())
+                return false;
+
+            if (index_count > entity_signatures.size())
+                entity_signatures.resize(index_count);
+
+            for (uint32_t i = 0; i < touched_count; i++)
+            {
+                uint32_t index;
+                uint32_t generation;
+                std::memcpy(&index, touched + i * sizeof(uint32_t), sizeof(uint32_t));
+                std::memcpy(&generation, touched_generations + i * sizeof(uint32_t), sizeof(uint32_t));
+
+                if (index >= index_count)
+                    return false;
+
+                // A new generation means the entity this world knows at index is gone
+                if (index < entities.indexCount() && entities.generationTable()[index] != generation)
+                    removeAllComponents(makeEntity(index, entities.generationTable()[index]));
+
+                entities.setGeneration(index, generation);
+            }
+
+            std::vector<uint32_t> free_indices(free_tail_count);
+
+            if (free_tail_count > 0)
+                std::memcpy(free_indices.data(), free_tail, free_indices.size() * sizeof(uint32_t));
+
+            entities.replaceFreeListTail(free_keep, free_indices.data(), free_indices.size());
+
+            return readTypeBlocks(in, snapshot_components, &SnapshotType::load_delta) && readTypeBlocks(in, snapshot_resources, &SnapshotType::load);
+        }
+
+        /// @brief Rolling per system stats and the Chrome trace of schedule runs, stays empty unless built with VECS_PROFILE
+        inline Profiler &profiler()
+        {
+            return system_profiler;
+        }
+
+        /// @brief Counts as a write for Changed<T>
+        template <typename T>
+        T *getComponent(Entity e)
+        {
+            uint32_t tick = writeTick();
+
+            if (storage_mode == StorageMode::Archetype)
+                return getArchetypeComponent<T>(e, &tick);
+
+            if (!entities.isAlive(e))
+                return nullptr;
+
+            SparseSet<T> &set = getOrCreateSparseSet<T>();
+            uint32_t index = entityIndex(e);
+
+            uint32_t dense_index = set.sparse.get(index);
+
+            if (dense_index == NO_ENTITY)
+                return nullptr;
+
+            set.markChanged(dense_index, tick);
+
+            return &set.components[dense_index];
+        }
+
+    private:
+        friend class CommandBuffer;
+
+        std::unique_ptr<thread_pool::ThreadPool> owned_pool; // Unless the world runs on a shared pool
+        thread_pool::ThreadPool &pool;
+
+        Profiler system_profiler{pool.threadCount()};
+
+        EntityAllocator entities;
+
+        using ScratchBytes = std::vector<unsigned char, AlignedAllocator<unsigned char>>;
+
+        /// @brief Per thread buffers of forEachChunk, components that are not contiguous and aligned in storage get gathered here
+        struct ChunkScratch
+        {
+            std::vector<Entity> entities;
+            std::vector<uint32_t> rows;       // Dense index per term and entity, term major
+            std::vector<ScratchBytes> buffers; // One per term
+        };
+
+        std::vector<std::unique_ptr<CommandBuffer>> command_buffers;
+        std::vector<std::unique_ptr<ChunkScratch>> chunk_scratch; // Same indexing as command_buffers
+
+        template <typename T>
+        static applyCommandQueues makeApplyForCommandQueue()
+        {
+            return [](Ecs *ecs, CommandQueueBase *const *queues, size_t count)
+            {
+                size_t add_count = 0;
+                uint32_t max_index = 0;
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    auto *queue = static_cast<CommandQueue<T> *>(queues[i]);
+
+                    add_count += queue->add_entities.size();
+
+                    for (Entity e : queue->add_entities)
+                        max_index = std::max(max_index, entityIndex(e));
+                }
+
+                if (ecs->storage_mode == StorageMode::SparseSet && add_count > 0)
+                {
+                    SparseSet<T> &set = ecs->getOrCreateSparseSet<T>();
+
+                    set.reserve(set.size() + add_count);
+
+                    set.sparse.reserve(max_index + 1);
+
+                    if (max_index >= ecs->entity_signatures.size())
+                        ecs->entity_signatures.resize(max_index + 1);
+                }
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    auto *queue = static_cast<CommandQueue<T> *>(queues[i]);
+
+                    for (size_t j = 0; j < queue->add_entities.size(); j++)
+                        ecs->addComponent<T>(queue->add_entities[j], std::move(queue->add_components[j]));
+                }
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    auto *queue = static_cast<CommandQueue<T> *>(queues[i]);
+
+                    for (Entity e : queue->remove_entities)
+                        ecs->removeComponent<T>(e);
+
+                    queue->clear();
+                }
+            };
+        }
+
+        /// @brief Registers wrapper with the access sets of Ts in schedule
+        template <typename... Ts>
+        uint32_t insertSystem(Schedule &schedule, SystemCallback wrapper)
+        {
+            // Access sets of this system, type and resource ids are the same in every world
+            const auto c_lookup_write_table = [&]()
+            {
+                bit::Bitset write(sizeof...(Ts));
+
+                ((writes_component<Ts>::value ? (write.setBit(getTypeId<typename unwrap_component<Ts>::type>(), true), true) : false), ...);
+
+                return write;
+            }();
+
+            const auto c_lookup_read_table = [&]()
+            {
+                bit::Bitset read(sizeof...(Ts));
+
+                ((reads_component<Ts>::value ? (read.setBit(getTypeId<typename unwrap_component<Ts>::type>(), true), true) : false), ...);
+
+                return read;
+            }();
+
+            const auto r_lookup_write_table = [&]()
+            {
+                bit::Bitset write(sizeof...(Ts));
+
+                ((isMutableResource<Ts>::value ? (write.setBit(getResourceId<typename unwrapResource<Ts>::type>(), true), true) : false), ...);
+
+                return write;
+            }();
+
+            const auto r_lookup_read_table = [&]()
+            {
+                bit::Bitset read(sizeof...(Ts));
+
+                ((isConstResource<Ts>::value ? (read.setBit(getResourceId<typename unwrapResource<Ts>::type>(), true), true) : false), ...);
+
+                return read;
+            }();
+
+            uint32_t system_id = getNextSystemId();
+
+            if (system_id >= systems.size())
+            {
+                systems.resize(system_id + 1);
+            }
+
+            systems[system_id] = SystemWrapper(std::move(wrapper), c_lookup_read_table, c_lookup_write_table, r_lookup_read_table, r_lookup_write_table);
+
+            schedule.systems.push_back(system_id);
+            schedule.dirty = true;
+
+            return system_id;
+        }
+
+        // Iteration, the public entry points and systems differ only in their ticks
+
+        template <typename... Ts, typename Func>
+        void runForEach(Func &func, SystemTicks ticks)
+        {
+            if (storage_mode == StorageMode::Archetype)
+            {
+                iterateArchetypes<Ts...>(ticks, [&](SystemView<Ts...> &view, const Archetype &archetype, const ArchetypeChunk &chunk, const uint32_t *columns)
+                                         { iterateArchetypeChunk<Ts...>(view, archetype, chunk, columns, func, std::index_sequence_for<Ts...>{}); });
+                return;
+            }
+
+            visitDrivingSet<Ts...>(ticks, [&](auto tag, SystemView<Ts...> &view, const Entity *driving, size_t count)
+                                   {
+                                       using smallest_T = typename decltype(tag)::type;
+
+                                       iterateSparseSet<smallest_T, Ts...>(view, driving, 0, count, func); });
+        }
+
+        template <typename... Ts, typename Func>
+        void runParallelForEach(Func &func, size_t chunk_size, SystemTicks ticks)
+        {
+            if (storage_mode == StorageMode::Archetype)
+            {
+                parallelIterateArchetypes<Ts...>([&](SystemView<Ts...> &view, const Archetype &archetype, const ArchetypeChunk &chunk, const uint32_t *columns)
+                                                 { iterateArchetypeChunk<Ts...>(view, archetype, chunk, columns, func, std::index_sequence_for<Ts...>{}); },
+                                                 chunk_size, ticks);
+                return;
+            }
+
+            visitDrivingSet<Ts...>(ticks, [&](auto tag, SystemView<Ts...> &view, const Entity *driving, size_t count)
+                                   {
+                                       using smallest_T = typename decltype(tag)::type;
+
+                                       parallelRange(count, chunk_size, [&](size_t begin, size_t end)
+                                                     {
+                                                         SystemView<Ts...> chunk_view = view;
+                                                         iterateSparseSet<smallest_T, Ts...>(chunk_view, driving, begin, end, func); }); });
+        }
+
+        template <typename... Ts, typename Func>
+        void runForEachChunk(Func &func, size_t max_span, SystemTicks ticks)
+        {
+            if (storage_mode == StorageMode::Archetype)
+            {
+                iterateArchetypes<Ts...>(ticks, [&](SystemView<Ts...> &view, const Archetype &archetype, const ArchetypeChunk &chunk, const uint32_t *columns)
+                                         { iterateArchetypeChunkSpans<Ts...>(view, archetype, chunk, columns, max_span, func, std::index_sequence_for<Ts...>{}); });
+                return;
+            }
+
+            visitDrivingSet<Ts...>(ticks, [&](auto tag, SystemView<Ts...> &view, const Entity *driving, size_t count)
+                                   {
+                                       using smallest_T = typename decltype(tag)::type;
+
+                                       iterateSparseSetSpans<smallest_T>(view, driving, 0, count, max_span, func, std::index_sequence_for<Ts...>{}); });
+        }
+
+        template <typename... Ts, typename Func>
+        void runParallelForEachChunk(Func &func, size_t max_span, SystemTicks ticks)
+        {
+            if (storage_mode == StorageMode::Archetype)
+            {
+                parallelIterateArchetypes<Ts...>([&](SystemView<Ts...> &view, const Archetype &archetype, const ArchetypeChunk &chunk, const uint32_t *columns)
+                                                 { iterateArchetypeChunkSpans<Ts...>(view, archetype, chunk, columns, max_span, func, std::index_sequence_for<Ts...>{}); },
+                                                 0, ticks);
+                return;
+            }
+
+            visitDrivingSet<Ts...>(ticks, [&](auto tag, SystemView<Ts...> &view, const Entity *driving, size_t count)
+                                   {
+                                       using smallest_T = typename decltype(tag)::type;
+
+                                       // Jobs cover whole spans
+                                       size_t job_size = std::max(max_span, PARALLEL_MIN_CHUNK);
+
+                                       parallelRange(count, 0, [&](size_t begin, size_t end)
+                                                     {
+                                                         SystemView<Ts...> chunk_view = view;
+                                                         iterateSparseSetSpans<smallest_T>(chunk_view, driving, begin, end, max_span, func, std::index_sequence_for<Ts...>{}); },
+                                                     job_size); });
+        }
+
+        /// @brief Every run gets its own tick, so concurrent systems never see their own writes as changes
+        inline SystemTicks beginRun(uint32_t last_run)
+        {
+            return {last_run, change_tick.fetch_add(1, std::memory_order_relaxed) + 1};
+        }
+
+        /// @brief Tick for changes outside of system runs, newer than every run so far
+        inline uint32_t writeTick() const
+        {
+            return change_tick.load(std::memory_order_relaxed) + 1;
+        }
+
+        std::atomic<uint32_t> change_tick{1};
+        uint32_t tracker_tick = 0; // Last run of forEach & co, moved by clearTrackers
+
+        static inline bool checkConflict(const SystemWrapper &a, const SystemWrapper &b)
+        {
+            bool c_conflict = ((a.c_write & b.c_write).any() || (a.c_write & b.c_read).any() || (b.c_write & a.c_read).any());
+            bool r_conflict = ((a.r_write & b.r_write).any() || (a.r_write & b.r_read).any() || (b.r_write & a.r_read).any());
+
+            return (c_conflict || r_conflict);
+        }
+
+        /// @brief Builds the dependency graph of a schedule. Conflicting systems get an edge in insertion order,
+        /// unless user orderings say otherwise
+        void compileSchedule(Schedule &schedule)
+        {
+            if (!schedule.dirty)
+                return;
+
+            size_t system_count = schedule.systems.size();
+
+            std::unordered_map<uint32_t, uint32_t> node_of_system;
+            for (uint32_t i = 0; i < system_count; i++)
+                node_of_system[schedule.systems[i]] = i;
+
+            std::vector<bool> has_edge(system_count * system_count, false);
+            std::vector<std::vector<uint32_t>> successors(system_count);
+            std::vector<uint32_t> predecessor_counts(system_count, 0);
+
+            auto addEdge = [&](uint32_t from, uint32_t to)
+            {
+                if (has_edge[from * system_count + to])
+                    return;
+
+                has_edge[from * system_count + to] = true;
+                successors[from].push_back(to);
+                predecessor_counts[to]++;
+            };
+
+            for (const auto &ordering : schedule.orderings)
+            {
+                auto first = node_of_system.find(ordering.first);
+                auto second = node_of_system.find(ordering.second);
+
+                if (first != node_of_system.end() && second != node_of_system.end())
+                    addEdge(first->second, second->second);
+            }
+
+            // Order that satisfies the user constraints, ties broken by insertion order so the result is deterministic
+            std::vector<uint32_t> order;
+            order.reserve(system_count);
+            {
+                std::vector<uint32_t> remaining_predecessors = predecessor_counts;
+                std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> ready;
+
+                for (uint32_t i = 0; i < system_count; i++)
+                    if (remaining_predecessors[i] == 0)
+                        ready.push(i);
+
+                while (!ready.empty())
+                {
+                    uint32_t node = ready.top();
+                    ready.pop();
+                    order.push_back(node);
+
+                    for (uint32_t next : successors[node])
+                        if (--remaining_predecessors[next] == 0)
+                            ready.push(next);
+                }
+            }
+
+            if (order.size() != system_count)
+            {
+                std::cerr << "Schedule ordering constraints contain a cycle\n";
+                std::abort();
+            }
+
+            for (size_t a = 0; a < system_count; a++)
+            {
+                for (size_t b = a + 1; b < system_count; b++)
+                {
+                    if (checkConflict(systems[schedule.systems[order[a]]], systems[schedule.systems[order[b]]]))
+                        addEdge(order[a], order[b]);
+                }
+            }
+
+            schedule.successors = std::move(successors);
+            schedule.predecessor_counts = std::move(predecessor_counts);
+            schedule.topological_order = std::move(order);
+
+            schedule.roots.clear();
+            for (uint32_t i = 0; i < system_count; i++)
+                if (schedule.predecessor_counts[i] == 0)
+                    schedule.roots.push_back(i);
+
+            schedule.costs.assign(system_count, 1.0);
+            schedule.priorities.assign(system_count, 0.0);
+            schedule.pending_predecessors = std::make_unique<std::atomic<uint32_t>[]>(system_count);
+
+            schedule.dirty = false;
+        }
+
+        /// @brief Recomputes the critical path lengths from the measured costs and sorts successors by them
+        void updateSchedulePriorities(Schedule &schedule)
+        {
+            auto &priorities = schedule.priorities;
+
+            for (auto it = schedule.topological_order.rbegin(); it != schedule.topological_order.rend(); ++it)
+            {
+                double longest_successor = 0.0;
+
+                for (uint32_t next : schedule.successors[*it])
+                    longest_successor = std::max(longest_successor, priorities[next]);
+
+                priorities[*it] = schedule.costs[*it] + longest_successor;
+            }
+
+            auto byPriority = [&priorities](uint32_t a, uint32_t b)
+            {
+                return priorities[a] > priorities[b] || (priorities[a] == priorities[b] && a < b);
+            };
+
+            for (auto &next : schedule.successors)
+                std::sort(next.begin(), next.end(), byPriority);
+
+            std::sort(schedule.roots.begin(), schedule.roots.end(), byPriority);
+        }
+
+        /// @brief Change filters of a system see everything since its previous run
+        inline void runSystem(uint32_t system_id)
+        {
+            SystemWrapper &system = systems[system_id];
+            SystemTicks ticks = beginRun(system.last_run);
+
+#ifdef VECS_PROFILE
+            uint32_t outer_system = Profiler::currentSystem();
+            uint64_t profile_start = system_profiler.now();
+
+            Profiler::setCurrentSystem(system_id);
+#endif
+
+            system.callback(this, ticks);
+
+#ifdef VECS_PROFILE
+            recordProfileEvent(ProfileEventKind::System, profile_start, system_id);
+            Profiler::setCurrentSystem(outer_system);
+#endif
+
+            system.last_run = ticks.this_run;
+        }
+
+#ifdef VECS_PROFILE
+        /// @brief Records an event from start_ns until now into the ring of the calling thread
+        inline void recordProfileEvent(ProfileEventKind kind, uint64_t start_ns, uint32_t system, uint64_t visited = 0, uint64_t matched = 0)
+        {
+            ProfileEvent event;
+            event.kind = kind;
+            event.system = system;
+            event.start_ns = start_ns;
+            event.duration_ns = system_profiler.now() - start_ns;
+            event.visited = visited;
+            event.matched = matched;
+
+            size_t worker = pool.currentWorkerIndex();
+            system_profiler.record(worker == thread_pool::ThreadPool::NO_WORKER ? pool.threadCount() : worker, event);
+        }
+#endif
+
+        /// @brief Runs a system, then releases its successors into group. The most critical ready successor continues on this thread
+        void runScheduleNode(Schedule &schedule, uint32_t node, thread_pool::TaskGroup &group)
+        {
+            static thread_local std::vector<uint32_t> ready;
+
+            while (true)
+            {
+                auto start = std::chrono::steady_clock::now();
+
+                runSystem(schedule.systems[node]);
+
+                double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+                schedule.costs[node] = schedule.costs[node] * 0.8 + micros * 0.2;
+
+                ready.clear();
+
+                // Successors are sorted by priority
+                for (uint32_t next : schedule.successors[node])
+                {
+                    if (schedule.pending_predecessors[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        ready.push_back(next);
+                }
+
+                // Lowest priority first, the owner pops its newest job first
+                for (size_t i = ready.size(); i > 1; i--)
+                {
+                    uint32_t next = ready[i - 1];
+                    group.spawn([this, &schedule, next, &group]()
+                                { runScheduleNode(schedule, next, group); });
+                }
+
+                bool has_next = !ready.empty();
+                uint32_t next = has_next ? ready[0] : 0;
+
+                if (!has_next)
+                    return;
+
+                node = next;
+            }
+        }
+
+        StorageMode storage_mode;
+
+        std::pmr::memory_resource *storage_resource = nullptr;
+
+        template <typename T>
+        T *getResource()
+        {
+            uint32_t id = getResourceId<T>();
+
+            if (id >= resources.size() || resources[id] == nullptr)
+            {
+                return nullptr;
+            }
+
+            ResourceData<T> *resource = static_cast<ResourceData<T> *>(resources[id]);
+
+            return &resource->data;
+        }
+
+        template <typename T>
+        resource_r<T> getResourceForLoop()
+        {
+            return getResource<typename unwrapResource<T>::type>();
+        }
+
+        template <typename T>
+        lambda_t<T> getComponentForLoop(Entity e)
+        {
+            return *getComponent<component_t<T>>(e);
+
+            // Lambda ensures read write access
+        }
+
+        template <typename... Ts>
+        bool hasComponents(Entity e)
+        {
+
+            return (... && (checkIfEntityHasComponent<Ts>(e)));
+        }
+
+        template <typename T>
+        bool checkIfEntityHasComponent(Entity e)
+        {
+            if constexpr (isConstResource<T>::value || isMutableResource<T>::value)
+            {
+                // Resources are global and return always true
+                return true;
+            }
+            else
+            {
+                uint32_t index = entityIndex(e);
+
+                return index < entity_signatures.size() && entity_signatures[index].test(getTypeId<component_t<T>>());
+            }
+        }
+
+        template <typename T>
+        auto getComponentOrResourceForLoop(Entity e) -> decltype(auto)
+        {
+            if constexpr (is_read_or_write<T>::value)
+                return getComponentForLoop<T>(e);
+
+            else
+                return getResourceForLoop<T>();
+        }
+
+        template <typename T>
+        struct type_tag
+        {
+            using type = T;
+        };
+
+        /// @brief Marks iteration over the prefix of an owning group instead of one query term's set
+        struct GroupDriven
+        {
+        };
+
+        /// @brief Picks what drives the iteration and calls visitor(type_tag<Driver>, view, entities, count): the smallest sparse set
+        /// of the query, or the prefix of an owning group whose components the query all requires, if that is not larger
+        template <typename... Ts, typename Visitor>
+        void visitDrivingSet(SystemTicks ticks, Visitor &&visitor)
+        {
+            SystemView<Ts...> view(this, ticks);
+
+            visitDrivingSet(view, visitor);
+        }
+
+        /// @brief Same for a view whose sets are already resolved, such as the one a Query keeps between runs
+        template <typename... Ts, typename Visitor>
+        void visitDrivingSet(SystemView<Ts...> &view, Visitor &&visitor)
+        {
+            size_t dense_sizes[] = {view.template drivingSize<Ts>()...};
+
+            std::fill(std::begin(view.lockstep), std::end(view.lockstep), false);
+            view.group_exact = false;
+
+            size_t smallest_index = 0;
+            size_t smallest_size = dense_sizes[0];
+
+            for (size_t i = 0; i < sizeof...(Ts); i++)
+            {
+                if (dense_sizes[i] < smallest_size)
+                {
+                    smallest_index = i;
+                    smallest_size = dense_sizes[i];
+                }
+            }
+
+            for (const auto &group : groups)
+            {
+                if (!view.query_mask.containsAll(group->mask) || group->size > smallest_size)
+                    continue;
+
+                size_t term = 0;
+
+                (
+                    [&]()
+                    {
+                        if constexpr (is_read_or_write<Ts>::value || is_tick_filter<Ts>::value)
+                            view.lockstep[term] = group->mask.test(getTypeId<component_t<Ts>>());
+
+                        term++;
+                    }(),
+                    ...);
+
+                view.group_exact = group->mask == view.query_mask && view.exclude_mask.none();
+
+                visitor(type_tag<GroupDriven>{}, view, group->entities->data(), size_t(group->size));
+                return;
+            }
+
+            size_t count = 0;
+
+            (
+                [&]()
+                {
+                    if constexpr (is_component_term<Ts>::value)
+                    {
+                        if (count == smallest_index)
+                        {
+                            const SparseSet<component_t<Ts>> *driving_set = view.template setOf<Ts>();
+                            visitor(type_tag<Ts>{}, view, driving_set->entities.data(), driving_set->size());
+                        }
+                    }
+
+                    count++;
+                }(),
+                ...);
+        }
+
+        static constexpr size_t PARALLEL_MIN_CHUNK = 1024;
+
+        /// @brief Runs body(begin, end) over [0, count) in chunks on the pool, the calling thread works on chunks too
+        template <typename Body>
+        void parallelRange(size_t count, size_t chunk_size, Body &&body, size_t min_chunk_size = PARALLEL_MIN_CHUNK)
+        {
+            if (count == 0)
+                return;
+
+            size_t workers = pool.threadCount();
+
+            if (chunk_size == 0)
+                chunk_size = std::max(min_chunk_size, count / ((workers + 1) * 4)); // ~4 chunks per thread for load balancing
+
+            size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+
+            if (chunk_count == 1 || workers == 0)
+            {
+                body(size_t(0), count);
+                return;
+            }
+
+#ifdef VECS_PROFILE
+            // Helpers count towards the system that split the range. The wait starts when the calling thread finds no chunk left
+            uint32_t system = Profiler::currentSystem();
+            std::thread::id caller = std::this_thread::get_id();
+            uint64_t wait_start = system_profiler.now();
+
+            auto chunk_body = [this, &body, &wait_start, system, caller](size_t begin, size_t end)
+            {
+                uint32_t outer_system = Profiler::currentSystem();
+                Profiler::setCurrentSystem(system);
+
+                body(begin, end);
+
+                Profiler::setCurrentSystem(outer_system);
+
+                if (std::this_thread::get_id() == caller)
+                    wait_start = system_profiler.now();
+            };
+#else
+            auto &chunk_body = body;
+#endif
+
+            thread_pool::parallelFor(pool, 0, count, chunk_size, chunk_body);
+
+#ifdef VECS_PROFILE
+            recordProfileEvent(ProfileEventKind::Wait, wait_start, system);
+#endif
+        }
+
+        /// @param driving Dense entities of the driving set smallest_T, or of a group prefix for GroupDriven
+        template <typename smallest_T, typename... Ts, typename Func>
+        inline void iterateSparseSet(SystemView<Ts...> &view, const Entity *driving, size_t begin, size_t end, Func &&func) noexcept
+        {
+
+            // smallest T is still in Wrapper
+
+            // Ensure that it is wrapped in either Component or Resource Wrapper
+            static_assert(is_component_term<smallest_T>::value || std::is_same_v<smallest_T, GroupDriven>);
+            static_assert((is_query_term<Ts>::value && ...));
+
+#ifdef VECS_PROFILE
+            uint64_t profile_start = system_profiler.now();
+            size_t matched = 0;
+#endif
+
+            for (size_t i = begin; i < end; i++)
+            {
+                Entity e = driving[i];
+
+                if (!view.template matches<smallest_T>(e, static_cast<uint32_t>(i)))
+                    continue;
+
+#ifdef VECS_PROFILE
+                matched++;
+#endif
+
+                invokeSystem<Ts...>(func, view, e, view.template getSystemArgument<Ts, smallest_T>(e, static_cast<uint32_t>(i))...);
+            }
+
+#ifdef VECS_PROFILE
+            recordProfileEvent(ProfileEventKind::Batch, profile_start, Profiler::currentSystem(), end - begin, matched);
+#endif
+        }
+
+        /// @brief Calls func(view, head, args...) with the arguments of filter terms left out, args has one entry per term
+        template <typename... Ts, typename Func, typename Head, typename... Args>
+        static inline void invokeSystem(Func &func, SystemView<Ts...> &view, Head &&head, Args &&...args)
+        {
+            if constexpr (!(is_filter<Ts>::value || ...))
+            {
+                func(view, std::forward<Head>(head), std::forward<Args>(args)...);
+            }
+            else
+            {
+                std::apply([&](auto &&...data)
+                           { func(view, std::forward<Head>(head), std::forward<decltype(data)>(data)...); },
+                           std::tuple_cat(termArguments<Ts>(std::forward<Args>(args))...));
+            }
+        }
+
+        template <typename T, typename Arg>
+        static inline auto termArguments(Arg &&arg)
+        {
+            if constexpr (is_filter<T>::value)
+                return std::tuple<>();
+            else
+                return std::forward_as_tuple(std::forward<Arg>(arg));
+        }
+
+        ChunkScratch &getChunkScratch()
+        {
+            size_t worker = pool.currentWorkerIndex();
+
+            if (worker == thread_pool::ThreadPool::NO_WORKER)
+                return *chunk_scratch.back();
+
+            return *chunk_scratch[worker];
+        }
+
+        static inline bool isContiguous(const uint32_t *rows, size_t count)
+        {
+            for (size_t k = 1; k < count; k++)
+                if (rows[k] != rows[0] + k)
+                    return false;
+
+            return true;
+        }
+
+        template <typename T>
+        static inline bool isCacheAligned(const T *data)
+        {
+            return reinterpret_cast<uintptr_t>(data) % COMPONENT_ALIGN == 0;
+        }
+
+        /// @brief Scratch of the calling thread with room for max_span entities and components of every term
+        template <typename... Ts, size_t... Is>
+        ChunkScratch &prepareChunkScratch(size_t max_span, std::index_sequence<Is...>)
+        {
+            ChunkScratch &scratch = getChunkScratch();
+
+            scratch.entities.resize(max_span);
+            scratch.rows.resize(max_span * sizeof...(Ts));
+
+            if (scratch.buffers.size() < sizeof...(Ts))
+                scratch.buffers.resize(sizeof...(Ts));
+
+            (
+                [&]()
+                {
+                    if constexpr (is_read_or_write<Ts>::value)
+                    {
+                        if (scratch.buffers[Is].size() < max_span * sizeof(component_t<Ts>))
+                            scratch.buffers[Is].resize(max_span * sizeof(component_t<Ts>));
+                    }
+                }(),
+                ...);
+
+            return scratch;
+        }
+
+        /// @brief Whether the span of term T can point into storage: the rows follow each other and the first starts on a cache line
+        template <typename T, typename... Ts>
+        inline bool isDirectSpan(SystemView<Ts...> &view, const uint32_t *rows, size_t count)
+        {
+            if constexpr (is_read_or_write<T>::value)
+                return isCacheAligned(view.template setOf<T>()->components.data() + rows[0]) && isContiguous(rows, count);
+            else
+                return false;
+        }
+
+        template <typename smallest_T, typename... Ts, typename Func, size_t... Is>
+        void iterateSparseSetSpans(SystemView<Ts...> &view, const Entity *driving, size_t begin, size_t end,
+                                   size_t max_span, Func &func, std::index_sequence<Is...>)
+        {
+            static_assert(is_component_term<smallest_T>::value || std::is_same_v<smallest_T, GroupDriven>);
+
+            ChunkScratch &scratch = prepareChunkScratch<Ts...>(max_span, std::index_sequence<Is...>{});
+
+            const Entity *entities = driving;
+            size_t i = begin;
+
+#ifdef VECS_PROFILE
+            uint64_t profile_start = system_profiler.now();
+            size_t matched = 0;
+#endif
+
+            while (i < end)
+            {
+                size_t count = 0;
+                size_t first = i;
+
+                // Collect up to max_span matching entities and where their components live
+                for (; i < end && count < max_span; i++)
+                {
+                    Entity e = entities[i];
+
+                    if (!view.template matches<smallest_T>(e, static_cast<uint32_t>(i)))
+                    {
+                        if (count == 0)
+                            first = i + 1;
+
+                        continue;
+                    }
+
+                    scratch.entities[count] = e;
+
+                    ((scratch.rows[Is * max_span + count] = getDenseIndex<Ts, smallest_T>(view, e, i)), ...);
+
+                    count++;
+                }
+
+                if (count == 0)
+                    continue;
+
+#ifdef VECS_PROFILE
+                matched += count;
+#endif
+
+                bool direct[] = {isDirectSpan<Ts>(view, &scratch.rows[Is * max_span], count)..., false};
+
+                const Entity *entity_span = (i - first == count) ? entities + first : scratch.entities.data();
+
+                invokeSystem<Ts...>(func, view, Span<const Entity>(entity_span, count),
+                                    getSpanArgument<Ts>(view, &scratch.rows[Is * max_span], count, direct[Is], scratch.buffers[Is])...);
+
+                (scatterSpanArgument<Ts>(view, &scratch.rows[Is * max_span], count, direct[Is], scratch.buffers[Is]), ...);
+            }
+
+#ifdef VECS_PROFILE
+            recordProfileEvent(ProfileEventKind::Batch, profile_start, Profiler::currentSystem(), end - begin, matched);
+#endif
+        }
+
+        template <typename T, typename smallest_T, typename... Ts>
+        inline uint32_t getDenseIndex(SystemView<Ts...> &view, Entity e, size_t driving_index)
+        {
+            if constexpr (is_read_or_write<T>::value || is_tick_filter<T>::value)
+                return view.template denseIndexOf<T, smallest_T>(view.template setOf<T>(), e, static_cast<uint32_t>(driving_index));
+            else
+                return 0;
+        }
+
+        /// @brief Span over storage if direct, otherwise gathers into buffer. Read terms get copied, Write terms moved
+        template <typename T, typename... Ts>
+        inline decltype(auto) getSpanArgument(SystemView<Ts...> &view, const uint32_t *rows, size_t count, bool direct, ScratchBytes &buffer)
+        {
+            if constexpr (is_filter<T>::value)
+            {
+                return FilterTerm{};
+            }
+            else if constexpr (is_read_or_write<T>::value)
+            {
+                using C = component_t<T>;
+
+                auto &components = view.template setOf<T>()->components;
+                C *data = components.data() + rows[0];
+
+                if (!direct)
+                {
+                    data = reinterpret_cast<C *>(buffer.data());
+
+                    for (size_t k = 0; k < count; k++)
+                    {
+                        if constexpr (is_read<T>::value)
+                            new (data + k) C(components[rows[k]]);
+                        else
+                            new (data + k) C(std::move(components[rows[k]]));
+                    }
+                }
+
+                if constexpr (is_read<T>::value)
+                    return Span<const C>(data, count);
+                else
+                    return Span<C>(data, count);
+            }
+            else
+            {
+                return view.template getSystemArgument<T>(NO_ENTITY);
+            }
+        }
+
+        /// @brief Stamps Write<T> rows as changed, moves gathered Write<T> data back and destroys the scratch copies
+        template <typename T, typename... Ts>
+        inline void scatterSpanArgument(SystemView<Ts...> &view, const uint32_t *rows, size_t count, bool direct, ScratchBytes &buffer)
+        {
+            if constexpr (is_read_or_write<T>::value)
+            {
+                using C = component_t<T>;
+
+                SparseSet<C> *sparse_set = view.template setOf<T>();
+
+                if constexpr (is_write<T>::value)
+                {
+                    for (size_t k = 0; k < count; k++)
+                        sparse_set->markChanged(rows[k], view.ticks.this_run);
+                }
+
+                if (direct)
+                    return;
+
+                auto &components = sparse_set->components;
+                C *data = reinterpret_cast<C *>(buffer.data());
+
+                for (size_t k = 0; k < count; k++)
+                {
+                    if constexpr (is_write<T>::value)
+                        components[rows[k]] = std::move(data[k]);
+
+                    data[k].~C();
+                }
+            }
+        }
+
+        template <typename T>
+        sparse_set_ptr_t<T> resolveSparseSet()
+        {
+            if constexpr (needs_storage<T>::value)
+            {
+                if (storage_mode == StorageMode::Archetype)
+                    return nullptr;
+
+                return &getOrCreateSparseSet<component_t<T>>();
+            }
+            else
+            {
+                return nullptr;
+            }
+        }
+
+        /// @brief Set whose membership decides whether an entity matches term T, nullptr for resources
+        template <typename T>
+        SparseSetBase *watchedSet()
+        {
+            if constexpr (needs_storage<T>::value || is_without<T>::value)
+                return &getOrCreateSparseSet<component_t<T>>();
+            else
+                return nullptr;
+        }
+
+        /// @return nullptr for terms that are not resources and for resources that were not inserted yet
+        template <typename T>
+        resource_ptr_t<T> resolveResource()
+        {
+            if constexpr (isResource<T>::value)
+            {
+                uint32_t id = getResourceId<typename unwrapResource<T>::type>();
+
+                return id < resources.size() ? static_cast<resource_ptr_t<T>>(resources[id]) : nullptr;
+            }
+            else
+            {
+                return nullptr;
+            }
+        }
+
+        template <typename T>
+        SparseSet<T> &getOrCreateSparseSet()
+        {
+            uint32_t type_id = getTypeId<T>();
+
+            if (type_id >= sets.size())
+                sets.resize(type_id + 1, nullptr);
+
+            if (sets[type_id] == nullptr)
+            {
+                sets[type_id] = createInResource<SparseSet<T>>(storage_resource, storage_resource);
+                sets[type_id]->remove = makeRemoveForSparseSet<T>();
+                sets[type_id]->destroy = [](SparseSetBase *base, std::pmr::memory_resource *resource)
+                { destroyInResource(resource, static_cast<SparseSet<T> *>(base)); };
+            }
+
+            return *static_cast<SparseSet<T> *>(sets[type_id]);
+        }
+
+        template <typename T>
+        inline static uint32_t getTypeId() noexcept
+        {
+            static const uint32_t id = []()
+            {
+                uint32_t new_id = next_id.fetch_add(1, std::memory_order_relaxed);
+
+                if (new_id >= MAX_COMPONENTS)
+                {
+                    std::cerr << "More than " << MAX_COMPONENTS << " component types, raise VECS_MAX_COMPONENTS\n";
+                    std::abort();
+                }
+
+                return new_id;
+            }();
+
+            return id;
+        }
+
+        static inline std::atomic<uint32_t> next_id{0}; // Shared by all worlds, worlds on other threads may register types concurrently
+
+        std::vector<SparseSetBase *> sets = {};
+
+        std::vector<std::unique_ptr<Group>> groups;
+
+        /// @brief Sorts the dense entries of T with less(set, a, b), a grouped set keeps its prefix and takes the other owned sets along
+        template <typename T, typename Less>
+        void sortSparseSet(Less &&less)
+        {
+            if (storage_mode == StorageMode::Archetype)
+                return;
+
+            SparseSet<T> &set = getOrCreateSparseSet<T>();
+
+            uint32_t count = static_cast<uint32_t>(set.size());
+            uint32_t split = set.group != nullptr ? set.group->size : 0;
+
+            std::vector<uint32_t> order(count);
+
+            for (uint32_t i = 0; i < count; i++)
+                order[i] = i;
+
+            auto compare = [&](uint32_t a, uint32_t b)
+            {
+                return less(set, a, b);
+            };
+
+            std::sort(order.begin(), order.begin() + split, compare);
+            std::sort(order.begin() + split, order.end(), compare);
+
+            if (set.group != nullptr)
+                set.group->permute(this, *set.group, order.data());
+
+            set.permute(order.data() + split, split, count);
+        }
+
+        static constexpr char SNAPSHOT_MAGIC[8] = {'V', 'E', 'C', 'S', 'S', 'N', 'A', 'P'};
+        static constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+        /// @brief A registered component or resource, save writes its block body and load reads it back
+        struct SnapshotType
+        {
+            uint64_t stable_id = 0;
+            uint32_t element_size = 0; // sizeof(T) for raw component blocks, 0 when hooks write the values
+            std::function<void(SnapshotWriter &)> save;
+            std::function<bool(SnapshotReader &, uint32_t element_size)> load;
+
+            // Components only
+            SparseSetBase *storage = nullptr;
+            std::function<void(SnapshotWriter &)> save_delta;
+            std::function<bool(SnapshotReader &, uint32_t element_size)> load_delta;
+        };
+
+        static constexpr char DELTA_MAGIC[8] = {'V', 'E', 'C', 'S', 'D', 'E', 'L', 'T'};
+        static constexpr uint32_t DELTA_VERSION = 1;
+
+        /// @brief Block per type: stable id, element size and body size, so readers can skip types they do not know
+        void writeTypeBlocks(SnapshotWriter &out, const std::vector<SnapshotType> &types, std::function<void(SnapshotWriter &)> SnapshotType::*save) const
+        {
+            out.writeValue(static_cast<uint32_t>(types.size()));
+
+            for (const SnapshotType &type : types)
+            {
+                out.writeValue(type.stable_id);
+                out.writeValue(type.element_size);
+
+                size_t size_offset = out.reserveValue<uint64_t>();
+                size_t body_start = out.size();
+
+                (type.*save)(out);
+
+                out.patch(size_offset, static_cast<uint64_t>(out.size() - body_start));
+            }
+        }
+
+        bool readTypeBlocks(SnapshotReader &in, const std::vector<SnapshotType> &types, std::function<bool(SnapshotReader &, uint32_t)> SnapshotType::*load)
+        {
+            uint32_t block_count = in.readValue<uint32_t>();
+
+            for (uint32_t i = 0; i < block_count && in.ok(); i++)
+            {
+                uint64_t stable_id = in.readValue<uint64_t>();
+                uint32_t element_size = in.readValue<uint32_t>();
+                uint64_t block_size = in.readValue<uint64_t>();
+
+                size_t body_end = in.position() + block_size;
+
+                auto type = std::find_if(types.begin(), types.end(), [stable_id](const SnapshotType &type)
+                                         { return type.stable_id == stable_id; });
+
+                if (type != types.end() && !(*type.*load)(in, element_size))
+                    return false;
+
+                if (in.position() > body_end)
+                    return false;
+
+                in.skip(body_end - in.position());
+            }
+
+            return in.ok();
+        }
+
+        std::vector<SnapshotType> snapshot_components;
+        std::vector<SnapshotType> snapshot_resources;
+
+        /// @param save, load nullptr for raw blocks
+        template <typename T, typename Save, typename Load>
+        void addSnapshotComponent(std::string_view name, uint32_t element_size, Save save, Load load)
+        {
+            SnapshotType type;
+            type.stable_id = stableTypeId(name);
+            type.element_size = element_size;
+
+            assert(std::none_of(snapshot_components.begin(), snapshot_components.end(), [&](const SnapshotType &other)
+                                { return other.stable_id == type.stable_id; }) &&
+                   "Snapshot name is taken");
+
+            type.save = [this, save](SnapshotWriter &out)
+            {
+                const SparseSet<T> &set = getOrCreateSparseSet<T>();
+                uint64_t count = set.size();
+
+                out.writeValue(count);
+
+                out.align();
+                out.write(set.entities.data(), count * sizeof(Entity));
+                out.align();
+                out.write(set.added_ticks.data(), count * sizeof(uint32_t));
+                out.align();
+                out.write(set.changed_ticks.data(), count * sizeof(uint32_t));
+                out.align();
+
+                if constexpr (std::is_null_pointer_v<Save>)
+                {
+                    out.write(set.components.data(), count * sizeof(T));
+                }
+                else
+                {
+                    for (const T &component : set.components)
+                        save(out, component);
+                }
+
+                size_t page_count_offset = out.reserveValue<uint32_t>();
+                uint32_t page_count = 0;
+
+                set.sparse.forEachPage([&](uint32_t page, const uint32_t *entries)
+                                       {
+                                           out.writeValue(page);
+                                           out.align();
+                                           out.write(entries, SparseArray::PAGE_SIZE * sizeof(uint32_t));
+
+                                           page_count++; });
+
+                out.patch(page_count_offset, page_count);
+            };
+
+            type.load = [this, load](SnapshotReader &in, uint32_t element_size)
+            {
+                constexpr uint32_t expected_size = std::is_null_pointer_v<Load> ? sizeof(T) : 0;
+
+                if (element_size != expected_size)
+                    return false; // Layout changed between builds
+
+                SparseSet<T> &set = getOrCreateSparseSet<T>();
+                uint64_t count = in.readValue<uint64_t>();
+
+                in.align();
+                const unsigned char *owners = in.take(count * sizeof(Entity));
+                in.align();
+                const unsigned char *added = in.take(count * sizeof(uint32_t));
+                in.align();
+                const unsigned char *changed = in.take(count * sizeof(uint32_t));
+                in.align();
+
+                if (!in.ok())
+                    return false;
+
+                set.entities.resize(count);
+                set.added_ticks.resize(count);
+                set.changed_ticks.resize(count);
+                set.version++;
+
+                if (count > 0)
+                {
+                    std::memcpy(set.entities.data(), owners, count * sizeof(Entity));
+                    std::memcpy(set.added_ticks.data(), added, count * sizeof(uint32_t));
+                    std::memcpy(set.changed_ticks.data(), changed, count * sizeof(uint32_t));
+                }
+
+                if constexpr (std::is_null_pointer_v<Load>)
+                {
+                    const unsigned char *components = in.take(count * sizeof(T));
+
+                    if (!in.ok())
+                        return false;
+
+                    set.components.resize(count);
+
+                    if (count > 0)
+                        std::memcpy(static_cast<void *>(set.components.data()), components, count * sizeof(T));
+                }
+                else
+                {
+                    set.components.clear();
+                    set.components.reserve(count);
+
+                    for (uint64_t i = 0; i < count; i++)
+                        set.components.push_back(load(in));
+                }
+
+                uint32_t page_count = in.readValue<uint32_t>();
+
+                for (uint32_t i = 0; i < page_count; i++)
+                {
+                    uint32_t page = in.readValue<uint32_t>();
+                    in.align();
+                    const unsigned char *entries = in.take(SparseArray::PAGE_SIZE * sizeof(uint32_t));
+
+                    if (!in.ok())
+                        return false;
+
+                    set.sparse.setPage(page, reinterpret_cast<const uint32_t *>(entries));
+                }
+
+                uint32_t type_id = getTypeId<T>();
+
+                for (Entity e : set.entities)
+                {
+                    if (entityIndex(e) >= entity_signatures.size())
+                        return false;
+
+                    entity_signatures[entityIndex(e)].set(type_id);
+                }
+
+                return in.ok();
+            };
+
+            type.storage = &getOrCreateSparseSet<T>();
+
+            type.save_delta = [this, save](SnapshotWriter &out)
+            {
+                const SparseSet<T> &set = getOrCreateSparseSet<T>();
+
+                std::vector<uint32_t> present; // Dense indices of added or written components
+                std::vector<uint32_t> removed; // Entity indices
+
+                set.dirty.forEach([&](uint32_t index)
+                                  {
+                                      uint32_t dense_index = set.sparse.get(index);
+
+                                      if (dense_index != NO_ENTITY)
+                                          present.push_back(dense_index);
+                                      else
+                                          removed.push_back(index); });
+
+                out.writeValue(static_cast<uint32_t>(present.size()));
+                out.writeValue(static_cast<uint32_t>(removed.size()));
+
+                out.align();
+                for (uint32_t dense_index : present)
+                    out.writeValue(set.entities[dense_index]);
+
+                out.align();
+                for (uint32_t dense_index : present)
+                {
+                    if constexpr (std::is_null_pointer_v<Save>)
+                        out.writeValue(set.components[dense_index]);
+                    else
+                        save(out, set.components[dense_index]);
+                }
+
+                out.align();
+                out.write(removed.data(), removed.size() * sizeof(uint32_t));
+            };
+
+            type.load_delta = [this, load](SnapshotReader &in, uint32_t element_size)
+            {
+                constexpr uint32_t expected_size = std::is_null_pointer_v<Load> ? sizeof(T) : 0;
+
+                if (element_size != expected_size)
+                    return false;
+
+                uint32_t present_count = in.readValue<uint32_t>();
+                uint32_t removed_count = in.readValue<uint32_t>();
+
+                in.align();
+                const unsigned char *owners = in.take(size_t(present_count) * sizeof(Entity));
+                in.align();
+
+                if (!in.ok())
+                    return false;
+
+                for (uint32_t i = 0; i < present_count; i++)
+                {
+                    Entity e;
+                    std::memcpy(&e, owners + i * sizeof(Entity), sizeof(Entity));
+
+                    T component = [&]()
+                    {
+                        if constexpr (std::is_null_pointer_v<Load>)
+                            return in.template readValue<T>();
+                        else
+                            return load(in);
+                    }();
+
+                    if (!in.ok() || !entities.isAlive(e))
+                        return false;
+
+                    if (T *current = getComponent<T>(e))
+                        *current = std::move(component);
+                    else
+                        addComponent<T>(e, std::move(component));
+                }
+
+                in.align();
+                const unsigned char *indices = in.take(size_t(removed_count) * sizeof(uint32_t));
+
+                if (!in.ok())
+                    return false;
+
+                for (uint32_t i = 0; i < removed_count; i++)
+                {
+                    uint32_t index;
+                    std::memcpy(&index, indices + i * sizeof(uint32_t), sizeof(uint32_t));
+
+                    if (index < entities.indexCount())
+                        removeComponent<T>(makeEntity(index, entities.generationTable()[index]));
+                }
+
+                return true;
+            };
+
+            snapshot_components.push_back(std::move(type));
+        }
+
+        template <typename T, typename Save, typename Load>
+        void addSnapshotResource(std::string_view name, Save save, Load load)
+        {
+            SnapshotType type;
+            type.stable_id = stableTypeId(name);
+
+            assert(std::none_of(snapshot_resources.begin(), snapshot_resources.end(), [&](const SnapshotType &other)
+                                { return other.stable_id == type.stable_id; }) &&
+                   "Snapshot name is taken");
+
+            type.save = [this, save](SnapshotWriter &out)
+            {
+                T *resource = getResource<T>();
+
+                out.writeValue(static_cast<uint8_t>(resource != nullptr));
+
+                if (resource != nullptr)
+                    save(out, *resource);
+            };
+
+            type.load = [this, load](SnapshotReader &in, uint32_t)
+            {
+                if (in.readValue<uint8_t>() != 0)
+                    insertResource<T>(load(in));
+
+                return in.ok();
+            };
+
+            snapshot_resources.push_back(std::move(type));
+        }
+
+        /// @brief Sparse set storage only
+        void removeAllComponents(Entity e)
+        {
+            uint32_t index = entityIndex(e);
+
+            if (index >= entity_signatures.size())
+                return;
+
+            for (const auto &group : groups)
+            {
+                if (entity_signatures[index].containsAll(group->mask))
+                    group->leave(this, *group, e);
+            }
+
+            // Index gets reused, so every component has to go
+            entity_signatures[index].forEachSetBit([&](uint32_t type_id)
+                                                   {
+                                                       SparseSetBase *set = sets[type_id];
+
+                                                       set->remove(set, e); });
+
+            entity_signatures[index].clear();
+        }
+
+        /// @brief Moves every entity that has all owned components into the prefix, the prefix must be empty or valid
+        void fillGroup(Group &group)
+        {
+            // Entering only swaps with the prefix end, which is never ahead of i
+            const StorageVector<Entity> &lead = *group.entities;
+
+            for (size_t i = 0; i < lead.size(); i++)
+            {
+                Entity e = lead[i];
+
+                if (entity_signatures[entityIndex(e)].containsAll(group.mask))
+                    group.enter(this, group, e);
+            }
+        }
+
+        template <typename... Ts>
+        static void enterGroup(Ecs *ecs, Group &group, Entity e)
+        {
+            uint32_t index = entityIndex(e);
+
+            if (ecs->getOrCreateSparseSet<std::tuple_element_t<0, std::tuple<Ts...>>>().sparse[index] < group.size)
+                return; // Already inside
+
+            (ecs->getOrCreateSparseSet<Ts>().swapDense(ecs->getOrCreateSparseSet<Ts>().sparse[index], group.size), ...);
+
+            group.size++;
+        }
+
+        template <typename... Ts>
+        static void permuteGroup(Ecs *ecs, Group &group, const uint32_t *order)
+        {
+            (ecs->getOrCreateSparseSet<Ts>().permute(order, 0, group.size), ...);
+        }
+
+        template <typename... Ts>
+        static void leaveGroup(Ecs *ecs, Group &group, Entity e)
+        {
+            uint32_t index = entityIndex(e);
+
+            group.size--;
+
+            (ecs->getOrCreateSparseSet<Ts>().swapDense(ecs->getOrCreateSparseSet<Ts>().sparse[index], group.size), ...);
+        }
+
+        template <typename T>
+        uint32_t getResourceId()
+        {
+            static const uint32_t id = next_resource_id.fetch_add(1, std::memory_order_relaxed); // Static = Unique per Resource Type
+            return id;
+        }
+
+        static inline std::atomic<uint32_t> next_resource_id{0};
+
+        std::vector<ResourceBase *> resources = {};
+
+        /// @brief System ids index this world's systems, so every world counts from 0
+        inline uint32_t getNextSystemId()
+        {
+            return next_system_id++;
+        };
+
+        uint32_t next_system_id = 0;
+
+        std::vector<SystemWrapper> systems;
+
+        std::vector<ComponentMask> entity_signatures; // Bit per component type the entity has, indexed by entity index
+
+        /// @brief Mask of all Without<T> terms of a query
+        template <typename... Ts>
+        static ComponentMask makeExcludeMask()
+        {
+            ComponentMask mask;
+
+            (
+                [&]()
+                {
+                    if constexpr (is_without<Ts>::value)
+                        mask.set(getTypeId<component_t<Ts>>());
+                }(),
+                ...);
+
+            return mask;
+        }
+
+        /// @brief Mask of all component terms of a query
+        template <typename... Ts>
+        static ComponentMask makeQueryMask()
+        {
+            ComponentMask mask;
+
+            (
+                [&]()
+                {
+                    if constexpr (is_component_term<Ts>::value)
+                        mask.set(getTypeId<component_t<Ts>>());
+                }(),
+                ...);
+
+            return mask;
+        }
+
+        /// @brief Shared by the batch overloads, Entities is anything with size() and operator[] returning Entity
+        template <typename... Ts, typename Entities>
+        void insertBatchImpl(const Entities &batch, Span<Ts>... components)
+        {
+            static_assert((!is_read_or_write<Ts>::value && ...));
+
+            size_t count = batch.size();
+            assert(((components.size() == count) && ...) && "Component spans differ in size");
+
+            if (count == 0)
+                return;
+
+            uint32_t max_index = 0;
+            for (size_t i = 0; i < count; i++)
+                max_index = std::max(max_index, entityIndex(batch[i]));
+
+            if (storage_mode == StorageMode::Archetype)
+            {
+                insertArchetypeBatch<Ts...>(batch, max_index, components...);
+                return;
+            }
+
+            if (max_index >= entity_signatures.size())
+                entity_signatures.resize(max_index + 1);
+
+            // Signatures are only updated after all sets are filled, so every set sees the state before the batch
+            (insertSparseSetBatch<Ts>(batch, max_index, components), ...);
+
+            ComponentMask batch_mask = makeQueryMask<Write<Ts>...>();
+
+            for (size_t i = 0; i < count; i++)
+            {
+                Entity e = batch[i];
+
+                if (entities.isAlive(e))
+                    entity_signatures[entityIndex(e)].merge(batch_mask);
+            }
+
+            for (const auto &group : groups)
+            {
+                if (!group->mask.intersects(batch_mask))
+                    continue;
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    Entity e = batch[i];
+
+                    if (entities.isAlive(e) && entity_signatures[entityIndex(e)].containsAll(group->mask))
+                        group->enter(this, *group, e);
+                }
+            }
+        }
+
+        template <typename T, typename Entities>
+        void insertSparseSetBatch(const Entities &batch, uint32_t max_index, Span<T> components)
+        {
+            SparseSet<T> &set = getOrCreateSparseSet<T>();
+
+            set.reserve(set.size() + batch.size());
+            set.sparse.reserve(max_index + 1);
+
+            uint32_t tick = writeTick();
+
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                Entity e = batch[i];
+                uint32_t index = entityIndex(e);
+
+                // The set itself, not the signature, so an entity listed twice in the batch keeps its first component
+                if (!entities.isAlive(e) || set.sparse.contains(index))
+                    continue;
+
+                set.push(e, std::move(components[i]), tick);
+            }
+        }
+
+        // Archetype Storage
+
+        /// @brief Fresh entities go straight into the archetype of Ts, entities that already have components take the per component path
+        template <typename... Ts, typename Entities>
+        void insertArchetypeBatch(const Entities &batch, uint32_t max_index, Span<Ts>... components)
+        {
+            (registerComponentInfo<Ts>(), ...);
+
+            std::vector<uint32_t> type_ids = {getTypeId<Ts>()...};
+            std::sort(type_ids.begin(), type_ids.end());
+
+            uint32_t target = getOrCreateArchetype(type_ids);
+            Archetype &archetype = *archetypes[target];
+
+            const uint32_t columns[] = {archetype.columnOf(getTypeId<Ts>())...};
+
+            if (max_index >= entity_locations.size())
+                entity_locations.resize(max_index + 1);
+
+            uint32_t tick = writeTick();
+
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                Entity e = batch[i];
+
+                if (!entities.isAlive(e))
+                    continue;
+
+                if (entity_locations[entityIndex(e)].archetype != NO_ARCHETYPE)
+                {
+                    (addArchetypeComponent<Ts>(e, std::move(components[i])), ...);
+                    continue;
+                }
+
+                EntityLocation loc = archetype.pushRow(e, target);
+                entity_locations[entityIndex(e)] = loc;
+
+                const ArchetypeChunk &chunk = archetype.chunks[loc.chunk];
+                size_t column = 0;
+
+                ((new (archetype.component(chunk, columns[column++], loc.row)) Ts(std::move(components[i]))), ...);
+
+                for (uint32_t c = 0; c < sizeof...(Ts); c++)
+                {
+                    archetype.addedTicks(chunk, c)[loc.row] = tick;
+                    archetype.changedTicks(chunk, c)[loc.row] = tick;
+                }
+            }
+        }
+
+        template <typename T>
+        void registerComponentInfo()
+        {
+            uint32_t type_id = getTypeId<T>();
+
+            if (type_id >= component_infos.size())
+                component_infos.resize(type_id + 1);
+
+            if (component_infos[type_id].size == 0)
+                component_infos[type_id] = makeComponentInfo<T>();
+        }
 
-                ((is_write<Ts>::value ? (write.setBit(getTypeId<typename unwrap_component<Ts>::type>(), true), true) : false), ...);
+        uint32_t getOrCreateArchetype(const std::vector<uint32_t> &type_ids)
+        {
+            auto it = archetype_lookup.find(type_ids);
 
-                return write;
-            }();
+            if (it != archetype_lookup.end())
+                return it->second;
 
-            static const auto c_lookup_read_table = [&]()
-            {
-                bit::Bitset read(sizeof...(Ts));
+            uint32_t index = static_cast<uint32_t>(archetypes.size());
 
-                ((is_read<Ts>::value ? (read.setBit(getTypeId<typename unwrap_component<Ts>::type>(), true), true) : false), ...);
+            archetypes.push_back(std::make_unique<Archetype>(type_ids, component_infos, storage_resource));
+            archetype_lookup.emplace(type_ids, index);
 
-                return read;
-            }();
+            return index;
+        }
 
-            static const auto r_lookup_write_table = [&]()
-            {
-                bit::Bitset write(sizeof...(Ts));
+        /// @brief Archetype reached by adding type_id to from, from may be NO_ARCHETYPE
+        uint32_t archetypeWith(uint32_t from, uint32_t type_id)
+        {
+            if (from == NO_ARCHETYPE)
+                return getOrCreateArchetype({type_id});
 
-                ((isMutableResource<Ts>::value ? (write.setBit(getResourceId<typename unwrapResource<Ts>::type>(), true), true) : false), ...);
+            auto edge = archetypes[from]->add_edges.find(type_id);
 
-                return write;
-            }();
+            if (edge != archetypes[from]->add_edges.end())
+                return edge->second;
 
-            static const auto r_lookup_read_table = [&]()
-            {
-                bit::Bitset read(sizeof...(Ts));
+            std::vector<uint32_t> type_ids = archetypes[from]->type_ids;
+            type_ids.insert(std::lower_bound(type_ids.begin(), type_ids.end(), type_id), type_id);
 
-                ((isConstResource<Ts>::value ? (read.setBit(getResourceId<typename unwrapResource<Ts>::type>(), true), true) : false), ...);
+            uint32_t to = getOrCreateArchetype(type_ids);
 
-                return read;
-            }();
+            archetypes[from]->add_edges[type_id] = to;
+            archetypes[to]->remove_edges[type_id] = from;
 
-            std::function<void(Ecs *)> wrapper = [func](Ecs *ecs)
-            {
-                ecs->forEach<Ts...>(func);
-            };
+            return to;
+        }
 
-            uint32_t system_id = getNextSystemId();
+        /// @brief Archetype reached by removing type_id from from, NO_ARCHETYPE if no components are left
+        uint32_t archetypeWithout(uint32_t from, uint32_t type_id)
+        {
+            auto edge = archetypes[from]->remove_edges.find(type_id);
 
-            if (system_id >= systems.size())
-            {
-                systems.resize(system_id + 1);
-            }
+            if (edge != archetypes[from]->remove_edges.end())
+                return edge->second;
 
-            SystemWrapper system(wrapper, c_lookup_read_table, c_lookup_write_table, r_lookup_read_table, r_lookup_write_table);
+            std::vector<uint32_t> type_ids = archetypes[from]->type_ids;
+            type_ids.erase(std::lower_bound(type_ids.begin(), type_ids.end(), type_id));
 
-            systems[system_id] = system;
+            uint32_t to = type_ids.empty() ? NO_ARCHETYPE : getOrCreateArchetype(type_ids);
 
-            schedule.systems.insert(system_id);
+            archetypes[from]->remove_edges[type_id] = to;
 
-            return system_id;
-        }
+            if (to != NO_ARCHETYPE)
+                archetypes[to]->add_edges[type_id] = from;
 
-        void removeSystem(Schedule &schedule, uint32_t system_id)
-        {
-            schedule.systems.erase(system_id);
+            return to;
         }
 
-        void runSchedule(Schedule schedule)
+        /// @brief Moves all shared components of e into a new row of to_index, components missing in the target get destroyed
+        EntityLocation moveEntityToArchetype(Entity e, uint32_t to_index)
         {
+            EntityLocation from_loc = entity_locations[entityIndex(e)];
 
-            std::vector<uint32_t> system_ids(schedule.systems.begin(), schedule.systems.end());
+            Archetype &to = *archetypes[to_index];
+            EntityLocation to_loc = to.pushRow(e, to_index);
 
-            for (uint32_t system_id : schedule.systems)
+            if (from_loc.archetype != NO_ARCHETYPE)
             {
-                SystemWrapper &current = systems[system_id];
+                Archetype &from = *archetypes[from_loc.archetype];
 
-                current.callback(this);
+                ArchetypeChunk &src_chunk = from.chunks[from_loc.chunk];
+                ArchetypeChunk &dst_chunk = to.chunks[to_loc.chunk];
+
+                for (uint32_t i = 0; i < from.type_ids.size(); i++)
+                {
+                    uint32_t dst_column = to.columnOf(from.type_ids[i]);
+                    void *src = from.component(src_chunk, i, from_loc.row);
+
+                    if (dst_column != NO_COLUMN)
+                    {
+                        from.column_infos[i].relocate(to.component(dst_chunk, dst_column, to_loc.row), src);
+                        to.copyTicks(dst_chunk, dst_column, to_loc.row, from, src_chunk, i, from_loc.row);
+                    }
+                    else
+                        from.column_infos[i].destroy(src);
+                }
+
+                Entity moved = from.popRow(from_loc);
+
+                if (moved != NO_ENTITY)
+                    entity_locations[entityIndex(moved)] = from_loc;
             }
+
+            entity_locations[entityIndex(e)] = to_loc;
+
+            return to_loc;
         }
 
-        void runScheduleParallel(Schedule schedule)
+        template <typename T>
+        void addArchetypeComponent(Entity e, T &&component)
         {
+            registerComponentInfo<T>();
 
-            auto checkConflict = [&schedule](const SystemWrapper &a, const SystemWrapper &b)
-            {
-                bool c_conflict = ((a.c_write & b.c_write).any() || (a.c_write & b.c_read).any() || (b.c_write & a.c_read).any());
-                bool r_conflict = ((a.r_write & b.r_write).any() || (a.r_write & b.r_read).any() || (b.r_write & a.r_read).any());
-
-                return (c_conflict || r_conflict);
-            };
+            uint32_t type_id = getTypeId<T>();
 
-            std::vector<uint32_t> system_ids(schedule.systems.begin(), schedule.systems.end());
+            if (entityIndex(e) >= entity_locations.size())
+                entity_locations.resize(entityIndex(e) + 1);
 
-            std::vector<std::vector<SystemWrapper *>> batches = {};
+            uint32_t from = entity_locations[entityIndex(e)].archetype;
 
-            for (uint32_t system_id : system_ids)
-            {
-                SystemWrapper &current = systems[system_id];
-                bool added_to_batch = false;
+            if (from != NO_ARCHETYPE && archetypes[from]->hasType(type_id))
+                return;
 
-                for (auto &batch : batches)
-                {
-                    bool conflict = false;
+            uint32_t to = archetypeWith(from, type_id);
 
-                    for (SystemWrapper *existing : batch)
-                    {
-                        if (checkConflict(current, *existing))
-                        {
-                            conflict = true;
-                            break;
-                        }
-                    }
+            EntityLocation loc = moveEntityToArchetype(e, to);
+            Archetype &archetype = *archetypes[to];
 
-                    if (!conflict)
-                    {
-                        batch.push_back(&current);
-                        added_to_batch = true;
-                        break;
-                    }
-                }
+            const ArchetypeChunk &chunk = archetype.chunks[loc.chunk];
+            uint32_t column = archetype.columnOf(type_id);
 
-                // Need more place, no place in other batches
-                if (!added_to_batch)
-                {
-                    batches.push_back({&current});
-                }
-            }
+            new (archetype.component(chunk, column, loc.row)) T(std::move(component));
 
-            for (auto &batch : batches)
-            {
+            archetype.addedTicks(chunk, column)[loc.row] = writeTick();
+            archetype.changedTicks(chunk, column)[loc.row] = writeTick();
+        }
 
-                std::atomic<size_t> jobs_remaining = batch.size();
-                std::condition_variable cv;
-                std::mutex cvMutex;
+        void removeArchetypeComponent(Entity e, uint32_t type_id)
+        {
+            if (entityIndex(e) >= entity_locations.size())
+                return;
 
-                for (auto *sys : batch)
-                {
+            uint32_t from = entity_locations[entityIndex(e)].archetype;
 
-                    pool.enqueue([this, sys, &jobs_remaining, &cv]()
-                                 {
-                                     sys->callback(this);
+            if (from == NO_ARCHETYPE || !archetypes[from]->hasType(type_id))
+                return;
 
-                                     if (--jobs_remaining == 0)
-                                         cv.notify_one(); // wake up main thread when all jobs done
-                                 });
-                }
+            uint32_t to = archetypeWithout(from, type_id);
 
-                {
-                    std::unique_lock<std::mutex> lock(cvMutex);
-                    cv.wait(lock, [&]()
-                            { return jobs_remaining == 0; });
-                }
-            }
+            if (to == NO_ARCHETYPE)
+                removeArchetypeEntity(e);
+            else
+                moveEntityToArchetype(e, to);
         }
 
-        void removeEntity(Entity e)
+        void removeArchetypeEntity(Entity e)
         {
+            if (entityIndex(e) >= entity_locations.size() || entity_locations[entityIndex(e)].archetype == NO_ARCHETYPE)
+                return;
 
-            if (e >= entity_what_components.size())
-                return; // Has no components or does not exist
+            EntityLocation loc = entity_locations[entityIndex(e)];
+            Archetype &archetype = *archetypes[loc.archetype];
 
-            for (size_t i = 0; i < entity_what_components[e].size(); i++)
-            {
-                SparseSetBase *set = sets[i];
+            archetype.destroyRow(archetype.chunks[loc.chunk], loc.row);
 
-                set->remove(set, e);
-            }
+            Entity moved = archetype.popRow(loc);
 
-            entity_what_components[e].clear();
-        };
+            if (moved != NO_ENTITY)
+                entity_locations[entityIndex(moved)] = loc;
+
+            entity_locations[entityIndex(e)] = EntityLocation{};
+        }
 
+        /// @param changed_tick Stamped as the change tick of the component if not null
         template <typename T>
-        T *getComponent(Entity e)
+        T *getArchetypeComponent(Entity e, const uint32_t *changed_tick = nullptr)
         {
-            SparseSet<T> set = getOrCreateSparseSet<T>();
+            if (entityIndex(e) >= entity_locations.size())
+                return nullptr;
+
+            const EntityLocation &loc = entity_locations[entityIndex(e)];
 
-            if (e >= set.sparse.size() || set.sparse[e] == NO_ENTITY)
+            if (loc.archetype == NO_ARCHETYPE)
                 return nullptr;
 
-            return &set.dense[set.sparse[e]].component;
-        }
+            Archetype &archetype = *archetypes[loc.archetype];
+            uint32_t column = archetype.columnOf(getTypeId<T>());
 
-    private:
-        thread_pool::ThreadPool pool;
+            if (column == NO_COLUMN)
+                return nullptr;
+
+            if (changed_tick != nullptr)
+                archetype.changedTicks(archetype.chunks[loc.chunk], column)[loc.row] = *changed_tick;
+
+            return static_cast<T *>(archetype.component(archetype.chunks[loc.chunk], column, loc.row));
+        }
 
         template <typename T>
-        T *getResource()
+        inline uint32_t archetypeColumnFor(const Archetype &archetype)
         {
-            uint32_t id = getResourceId<T>();
+            if constexpr (needs_storage<T>::value)
+                return archetype.columnOf(getTypeId<component_t<T>>());
+            else
+                return 0; // Resources are not stored in archetypes
+        }
 
-            if (id >= resources.size())
+        template <typename T, typename... Ts>
+        inline decltype(auto) getArchetypeArgument(SystemView<Ts...> &view, void *column, Entity e, uint32_t row)
+        {
+            if constexpr (is_filter<T>::value)
             {
-                return nullptr;
+                return FilterTerm{};
             }
+            else if constexpr (is_optional<T>::value)
+            {
+                // Optional columns are null for archetypes without T
+                component_t<T> *component = column == nullptr ? nullptr : static_cast<component_t<T> *>(column) + row;
 
-            ResourceData<T> *resource = static_cast<ResourceData<T> *>(resources[id]);
+                if constexpr (writes_component<T>::value)
+                    return component;
+                else
+                    return static_cast<const component_t<T> *>(component);
+            }
+            else if constexpr (is_read_or_write<T>::value)
+            {
+                component_t<T> *components = static_cast<component_t<T> *>(column);
 
-            return &resource->data;
+                if constexpr (is_read<T>::value)
+                    return static_cast<const component_t<T> &>(components[row]);
+                else
+                    return static_cast<component_t<T> &>(components[row]);
+            }
+            else
+            {
+                return view.template getSystemArgument<T>(e);
+            }
+        }
+
+        template <typename... Ts, typename Func, size_t... Is>
+        inline void iterateArchetypeChunk(SystemView<Ts...> &view, const Archetype &archetype, const ArchetypeChunk &chunk,
+                                          const uint32_t *columns, Func &func, std::index_sequence<Is...>)
+        {
+            void *column_data[] = {((is_read_or_write<Ts>::value || is_optional<Ts>::value) && columns[Is] != NO_COLUMN ? archetype.column(chunk, columns[Is]) : nullptr)..., nullptr};
+            uint32_t *tick_data[] = {archetypeTicks<Ts>(archetype, chunk, columns[Is])..., nullptr};
+            const Entity *entities = chunk.entities();
+
+            if constexpr (!(is_tick_filter<Ts>::value || ...))
+            {
+                // Every row gets visited, stamp the write ticks in one go and keep the row loop free of them
+                (markArchetypeWrite<Ts>(tick_data[Is], 0, chunk.count, view.ticks), ...);
+
+                for (uint32_t row = 0; row < chunk.count; row++)
+                {
+                    Entity e = entities[row];
+                    invokeSystem<Ts...>(func, view, e, getArchetypeArgument<Ts>(view, column_data[Is], e, row)...);
+                }
+            }
+            else
+            {
+                for (uint32_t row = 0; row < chunk.count; row++)
+                {
+                    if (!(passesArchetypeFilter<Ts>(tick_data[Is], row, view.ticks) && ...))
+                        continue;
+
+                    (markArchetypeWrite<Ts>(tick_data[Is], row, 1, view.ticks), ...);
+
+                    Entity e = entities[row];
+                    invokeSystem<Ts...>(func, view, e, getArchetypeArgument<Ts>(view, column_data[Is], e, row)...);
+                }
+            }
         }
 
+        /// @brief Tick array a term reads or stamps: added / changed ticks for filters, changed ticks for Write<T>
         template <typename T>
-        resource_r<T> getResourceForLoop()
+        inline uint32_t *archetypeTicks(const Archetype &archetype, const ArchetypeChunk &chunk, uint32_t column)
         {
-            return getResource<typename unwrapResource<T>::type>();
+            if constexpr (is_added<T>::value)
+                return archetype.addedTicks(chunk, column);
+            else if constexpr (is_tick_filter<T>::value || is_write<T>::value)
+                return archetype.changedTicks(chunk, column);
+            else if constexpr (writes_component<T>::value)
+                return column == NO_COLUMN ? nullptr : archetype.changedTicks(chunk, column); // Optional<Write<T>>
+            else
+                return nullptr;
         }
 
         template <typename T>
-        lambda_t<T> getComponentForLoop(Entity e)
+        static inline bool passesArchetypeFilter(const uint32_t *ticks, size_t row, SystemTicks system_ticks)
         {
-            return *getComponent<component_t<T>>(e);
+            if constexpr (is_tick_filter<T>::value)
+                return isNewerTick(ticks[row], system_ticks.last_run);
+            else
+                return true;
+        }
 
-            // Lambda ensures read write access
+        template <typename T>
+        static inline void markArchetypeWrite(uint32_t *ticks, size_t row, size_t count, SystemTicks system_ticks)
+        {
+            if constexpr (writes_component<T>::value)
+            {
+                if (ticks != nullptr)
+                    std::fill(ticks + row, ticks + row + count, system_ticks.this_run);
+            }
         }
 
-        template <typename... Ts>
-        bool hasComponents(Entity e)
+        template <typename... Ts, typename Func, size_t... Is>
+        inline void iterateArchetypeChunkSpans(SystemView<Ts...> &view, const Archetype &archetype, const ArchetypeChunk &chunk,
+                                               const uint32_t *columns, size_t max_span, Func &func, std::index_sequence<Is...>)
         {
+            void *column_data[] = {(is_read_or_write<Ts>::value ? archetype.column(chunk, columns[Is]) : nullptr)..., nullptr};
+            uint32_t *tick_data[] = {archetypeTicks<Ts>(archetype, chunk, columns[Is])..., nullptr};
+            const Entity *entities = chunk.entities();
 
-            return (... && (checkIfEntityHasComponent<Ts>(e)));
+            ChunkScratch &scratch = prepareChunkScratch<Ts...>(max_span, std::index_sequence<Is...>{});
+
+            // Columns are contiguous and start on a cache line. Filters split them into runs of passing rows and max_span into
+            // pieces, a run that does not start on a cache line in some column gets gathered for that column
+            size_t row = 0;
+
+            while (row < chunk.count)
+            {
+                while (row < chunk.count && !(passesArchetypeFilter<Ts>(tick_data[Is], row, view.ticks) && ...))
+                    row++;
+
+                size_t count = 0;
+
+                while (row + count < chunk.count && count < max_span && (passesArchetypeFilter<Ts>(tick_data[Is], row + count, view.ticks) && ...))
+                    count++;
+
+                if (count == 0)
+                    break;
+
+                bool direct[] = {(is_read_or_write<Ts>::value && isCacheAligned(static_cast<const unsigned char *>(column_data[Is]) + row * sizeof(component_t<Ts>)))..., false};
+
+                invokeSystem<Ts...>(func, view, Span<const Entity>(entities + row, count),
+                                    getArchetypeSpanArgument<Ts>(view, column_data[Is], row, count, direct[Is], scratch.buffers[Is])...);
+
+                (scatterArchetypeSpanArgument<Ts>(column_data[Is], row, count, direct[Is], scratch.buffers[Is]), ...);
+                (markArchetypeWrite<Ts>(tick_data[Is], row, count, view.ticks), ...);
+
+                row += count;
+            }
         }
 
-        template <typename T>
-        bool checkIfEntityHasComponent(Entity e)
+        /// @brief Span over the column if direct, otherwise gathers into buffer like getSpanArgument
+        template <typename T, typename... Ts>
+        inline decltype(auto) getArchetypeSpanArgument(SystemView<Ts...> &view, void *column, size_t row, size_t count, bool direct, ScratchBytes &buffer)
         {
-            if constexpr (isConstResource<T>::value || isMutableResource<T>::value)
+            if constexpr (is_filter<T>::value)
             {
-                // Resources are global and return always true
-                return true;
+                return FilterTerm{};
+            }
+            else if constexpr (is_read_or_write<T>::value)
+            {
+                using C = component_t<T>;
+
+                C *components = static_cast<C *>(column) + row;
+
+                if (!direct)
+                {
+                    C *data = reinterpret_cast<C *>(buffer.data());
+
+                    for (size_t k = 0; k < count; k++)
+                    {
+                        if constexpr (is_read<T>::value)
+                            new (data + k) C(components[k]);
+                        else
+                            new (data + k) C(std::move(components[k]));
+                    }
+
+                    components = data;
+                }
+
+                if constexpr (is_read<T>::value)
+                    return Span<const C>(components, count);
+                else
+                    return Span<C>(components, count);
             }
             else
             {
-                return e < getOrCreateSparseSet<component_t<T>>().sparse.size() &&
-                       getOrCreateSparseSet<component_t<T>>().sparse[e] != NO_ENTITY;
+                return view.template getSystemArgument<T>(NO_ENTITY);
             }
         }
 
+        /// @brief Moves gathered Write<T> data back into the column and destroys the scratch copies
         template <typename T>
-        auto getComponentOrResourceForLoop(Entity e) -> decltype(auto)
+        static inline void scatterArchetypeSpanArgument(void *column, size_t row, size_t count, bool direct, ScratchBytes &buffer)
         {
             if constexpr (is_read_or_write<T>::value)
-                return getComponentForLoop<T>(e);
-
-            else
-                return getResourceForLoop<T>();
-        }
+            {
+                using C = component_t<T>;
 
-        template <typename smallest_T, typename... Ts, typename Func>
-        inline void iterateSparseSet(SparseSet<component_t<smallest_T>> *smallest_set, uint32_t smallest_index, Func &&func) noexcept
-        {
+                if (direct)
+                    return;
 
-            // smallest T is still in Wrapper
+                C *components = static_cast<C *>(column) + row;
+                C *data = reinterpret_cast<C *>(buffer.data());
 
-            // Ensure that it is wrapped in either Component or Resource Wrapper
-            static_assert(is_read_or_write<smallest_T>::value);
-            static_assert(((is_read_or_write<Ts>::value || isMutableResource<Ts>::value || isConstResource<Ts>::value) && ...));
+                for (size_t k = 0; k < count; k++)
+                {
+                    if constexpr (is_write<T>::value)
+                        components[k] = std::move(data[k]);
 
-            if (smallest_set == nullptr)
-                return;
+                    data[k].~C();
+                }
+            }
+        }
 
-            SystemView<Ts...> view(this);
+        /// @brief Calls visit(view, archetype, chunk, columns) for every non empty chunk of every matching archetype
+        template <typename... Ts, typename Visit>
+        void iterateArchetypes(SystemTicks ticks, Visit &&visit)
+        {
+            SystemView<Ts...> view(this, ticks);
 
-            size_t smallest_size = smallest_set->dense.size();
-            for (size_t i = 0; i < smallest_size; i++)
+            for (auto &archetype_ptr : archetypes)
             {
-                Entity e = smallest_set->dense[i].entity;
+                const Archetype &archetype = *archetype_ptr;
 
-                if (!view.template hasAllComponents<smallest_T>(e))
+                if (archetype.entity_count == 0 || !archetype.signature.containsAll(view.query_mask) || archetype.signature.intersects(view.exclude_mask))
                     continue;
 
-                func(view, e, view.template getSystemArgument<Ts>(e)...);
+                uint32_t columns[] = {archetypeColumnFor<Ts>(archetype)..., 0};
+
+                for (const ArchetypeChunk &chunk : archetype.chunks)
+                    visit(view, archetype, chunk, columns);
             }
         }
 
-        template <typename T>
-        SparseSet<T> &getOrCreateSparseSet()
+        /// @brief iterateArchetypes on the thread pool, archetype chunks are the unit of work
+        template <typename... Ts, typename Visit>
+        void parallelIterateArchetypes(Visit &&visit, size_t chunk_size, SystemTicks ticks)
         {
-            uint32_t type_id = getTypeId<T>();
+            struct ChunkJob
+            {
+                const Archetype *archetype;
+                const ArchetypeChunk *chunk;
+                uint32_t columns[sizeof...(Ts) + 1];
+            };
 
-            if (type_id >= sets.size())
-                sets.resize(type_id + 1, nullptr);
+            std::vector<ChunkJob> jobs;
+            size_t row_count = 0;
 
-            if (sets[type_id] == nullptr)
+            ComponentMask query_mask = makeQueryMask<Ts...>();
+            ComponentMask exclude_mask = makeExcludeMask<Ts...>();
+
+            for (auto &archetype_ptr : archetypes)
             {
-                sets[type_id] = new SparseSet<T>();
-                sets[type_id]->remove = makeRemoveForSparseSet<T>();
+                const Archetype &archetype = *archetype_ptr;
+
+                if (archetype.entity_count == 0 || !archetype.signature.containsAll(query_mask) || archetype.signature.intersects(exclude_mask))
+                    continue;
+
+                ChunkJob job{&archetype, nullptr, {archetypeColumnFor<Ts>(archetype)..., 0}};
+
+                for (const ArchetypeChunk &chunk : archetype.chunks)
+                {
+                    job.chunk = &chunk;
+                    jobs.push_back(job);
+                }
+
+                row_count += archetype.entity_count;
             }
 
-            return *static_cast<SparseSet<T> *>(sets[type_id]);
+            if (jobs.empty())
+                return;
+
+            // Archetype chunks are the unit of work, convert the entity based sizes
+            size_t rows_per_chunk = std::max<size_t>(1, row_count / jobs.size());
+            size_t jobs_per_task = chunk_size == 0 ? 0 : std::max<size_t>(1, chunk_size / rows_per_chunk);
+            size_t min_jobs_per_task = std::max<size_t>(1, PARALLEL_MIN_CHUNK / rows_per_chunk);
+
+            SystemView<Ts...> view(this, ticks);
+
+            parallelRange(jobs.size(), jobs_per_task, [&](size_t begin, size_t end)
+                          {
+                              SystemView<Ts...> chunk_view = view;
+
+                              for (size_t i = begin; i < end; i++)
+                                  visit(chunk_view, *jobs[i].archetype, *jobs[i].chunk, jobs[i].columns); },
+                          min_jobs_per_task);
         }
 
-        template <typename T>
-        inline static uint32_t getTypeId() noexcept
+        std::vector<std::unique_ptr<Archetype>> archetypes;
+        std::map<std::vector<uint32_t>, uint32_t> archetype_lookup; // Sorted type ids -> archetype index
+        std::vector<EntityLocation> entity_locations;
+        std::vector<ComponentInfo> component_infos;
+    };
+
+    template <typename... Ts>
+    using Query = Ecs::Query<Ts...>;
+
+    /// @brief One world and the schedule it runs per frame, see runWorlds
+    struct WorldFrame
+    {
+        Ecs *world = nullptr;
+        Schedule *schedule = nullptr;
+        bool parallel = false; // runScheduleParallel instead of runSchedule
+    };
+
+    /// @brief Runs one frame of every world, each world as one job on pool. Worlds share no state, so they tick concurrently.
+    /// Create the worlds with pool as their shared pool, then their parallel systems use the same threads instead of
+    /// oversubscribing the machine. The calling thread works on jobs until every world is done
+    inline void runWorlds(thread_pool::ThreadPool &pool, Span<WorldFrame> frames)
+    {
+        thread_pool::TaskGroup group(pool);
+
+        for (WorldFrame &frame : frames)
         {
-            static const uint32_t id = next_id++;
-            return id;
+            group.spawn([&frame]()
+                        {
+                            if (frame.parallel)
+                                frame.world->runScheduleParallel(*frame.schedule);
+                            else
+                                frame.world->runSchedule(*frame.schedule);
+                        });
         }
 
-        static inline uint32_t next_id = 0;
-
-        std::vector<SparseSetBase *> sets = {};
+        group.wait();
+    }
 
-        template <typename T>
-        uint32_t getResourceId()
+    inline Entity CommandBuffer::createEntity()
+    {
+        if (reserved_next == reserved_end)
         {
-            static uint32_t id = next_resource_id++; // Static = Unique per Resource Type
-            return id;
+            ecs->entities.reserveBlock(reserved_block, ENTITY_BLOCK_SIZE);
+
+            reserved_next = 0;
+            reserved_end = ENTITY_BLOCK_SIZE;
         }
 
-        static inline uint32_t next_resource_id = 0;
+        return reserved_block[reserved_next++];
+    }
 
-        std::vector<ResourceBase *> resources = {};
+    template <typename T>
+    CommandQueue<T> &CommandBuffer::getQueue()
+    {
+        uint32_t type_id = Ecs::getTypeId<T>();
 
-        inline uint32_t getNextSystemId()
+        if (type_id >= queues.size())
+            queues.resize(type_id + 1);
+
+        if (!queues[type_id])
         {
-            static uint32_t next_system_id = 0;
-            uint32_t id = next_system_id++;
-            return id;
-        };
+            queues[type_id] = std::make_unique<CommandQueue<T>>();
+            queues[type_id]->apply = Ecs::makeApplyForCommandQueue<T>();
+        }
 
-        std::vector<SystemWrapper> systems;
+        CommandQueue<T> &queue = *static_cast<CommandQueue<T> *>(queues[type_id].get());
 
-        std::vector<std::unordered_set<uint32_t>> entity_what_components; // Caches what entity has which components
-    };
+        if (!queue.used)
+        {
+            queue.used = true;
+            used_types.push_back(type_id);
+        }
+
+        return queue;
+    }
+
+    template <typename T>
+    void CommandBuffer::addComponent(Entity e, T component)
+    {
+        CommandQueue<T> &queue = getQueue<T>();
+
+        queue.add_entities.push_back(e);
+        queue.add_components.push_back(std::move(component));
+    }
+
+    template <typename T>
+    void CommandBuffer::removeComponent(Entity e)
+    {
+        getQueue<T>().remove_entities.push_back(e);
+    }
 }
\ No newline at end of file